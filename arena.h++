@@ -0,0 +1,298 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef CODEGEN_ARENA_H
+#define CODEGEN_ARENA_H
+
+#include <algorithm>
+#include <mutex>
+
+#include "program.h++"
+
+namespace codegen
+{
+    // An arena links many programs into large shared chunks of memory instead of mapping pages for
+    // each of them separately. A chunk is mapped once; text is bump allocated from its bottom and
+    // data and bss from its top, so a function is never further than a chunk away from its data,
+    // well within the reach of 32 bit relative offsets.
+    //
+    // Text pages are writable only until they are sealed, which makes them executable for good.
+    // Normally, every link seals its pages right away. Within a batch, the pages are sealed once for
+    // all the programs linked, when the (outermost) batch ends, and the programs cannot be run before
+    // that. Sealed pages are never made writable again: text linked after a seal starts on the next
+    // page, so code already linked keeps running while more is linked, at the cost of less than a
+    // page per seal. Linking, batches and releasing are serialized by a mutex, so many threads can
+    // link into an arena at the same time, and the functions can be destroyed on any thread.
+    //
+    // The memory of a program is reclaimed immediately, if it was the last one allocated from its
+    // chunk, except for text pages that have been sealed, and the whole chunk is reclaimed when the
+    // last program in it is released. The arena itself must outlive all the functions linked into it.
+    class arena
+    {
+        struct chunk
+        {
+            byte *_base;
+            std::size_t _size;
+            std::size_t _text = 0;      // text is allocated upwards from here
+            std::size_t _data;          // data and bss are allocated downwards from here
+            std::size_t _sealed = 0;    // text pages below this are executable
+            std::size_t _dirty;         // the lowest text written since sealing; _size if none
+            unsigned _live = 0;
+        };
+
+        class block : public program
+        {
+            arena &_arena;
+            chunk *_chunk;
+            std::size_t _text_from, _text_to, _data_from, _data_to;
+
+        public:
+
+            block(arena &a, chunk *c, std::size_t text_from, std::size_t text, std::size_t text_to, std::size_t data_from, std::size_t data_to)
+                : _arena(a), _chunk(c), _text_from(text_from), _text_to(text_to), _data_from(data_from), _data_to(data_to)
+            {
+                _pages = c->_base + text;
+                _text_bytes = text_to - text;
+            }
+
+            ~block()
+            {
+                _arena.release(_chunk, _text_from, _text_to, _data_from, _data_to);
+            }
+        };
+
+        std::vector<chunk *> _chunks;
+        std::vector<chunk *> _dirty_chunks;
+        chunk *_current = nullptr;
+        std::size_t _chunk_size;
+        std::size_t _mapped = 0;
+        unsigned _batches = 0;
+        std::mutex _mutex;
+
+        static constexpr std::size_t text_alignment = 16;
+        static constexpr std::size_t data_alignment = 64; // TODO: non-hard-coded cache line alignment
+
+        static std::size_t page_floor(std::size_t p)
+        {
+            return p & ~(program::page_size() - 1);
+        }
+
+        static bool fit(const chunk &c, std::size_t text_size, std::size_t data_size, std::size_t &t, std::size_t &d)
+        {
+            t = program::align(std::max(c._text, c._sealed), text_alignment);
+            if (data_size > c._data) return false;
+            d = (c._data - data_size) & ~(data_alignment - 1);
+            return program::align(t + text_size) <= page_floor(d);
+        }
+
+        chunk *new_chunk(std::size_t size)
+        {
+            chunk *c = new chunk();
+
+#       ifdef CODEGEN_USE_MMAP
+
+            void *block = mmap(0, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+            if (block == MAP_FAILED)
+            {
+                delete c;
+                throw program::exception();
+            }
+            c->_base = (byte *)block;
+
+#       else
+
+#            error "No implementation of codegen::arena available."
+
+#       endif
+
+            c->_size = size;
+            c->_data = c->_dirty = size;
+            _chunks.push_back(c);
+            _mapped += size;
+            return c;
+        }
+
+        void unmap(chunk *c)
+        {
+
+#       ifdef CODEGEN_USE_MMAP
+
+            munmap(c->_base, c->_size);
+
+#       endif
+
+            _mapped -= c->_size;
+            _chunks.erase(std::find(_chunks.begin(), _chunks.end(), c));
+            auto dirty = std::find(_dirty_chunks.begin(), _dirty_chunks.end(), c);
+            if (dirty != _dirty_chunks.end()) _dirty_chunks.erase(dirty);
+            if (_current == c) _current = nullptr;
+            delete c;
+        }
+
+        void seal()
+        {
+            for (auto c : _dirty_chunks)
+            {
+                if (c->_dirty == c->_size) continue;
+                std::size_t from = c->_sealed, to = program::align(c->_text);
+
+#           ifdef CODEGEN_USE_MMAP
+
+                if (to > from && mprotect(c->_base + from, to - from, PROT_READ | PROT_EXEC) == -1) throw program::exception();
+
+#           endif
+
+                c->_sealed = std::max(from, to);
+                c->_dirty = c->_size;
+            }
+            _dirty_chunks.clear();
+        }
+
+        void release(chunk *c, std::size_t text_from, std::size_t text_to, std::size_t data_from, std::size_t data_to)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            // Text is only rolled back down to the sealed pages, which are never written again.
+            if (c->_text == text_to) c->_text = std::max(text_from, c->_sealed);
+            if (c->_data == data_from) c->_data = data_to;
+            if (--c->_live) return;
+            if (c != _current)
+            {
+                unmap(c);
+                return;
+            }
+
+            // The current chunk is kept mapped, but its pages are given back to the system. The
+            // sealed text pages stay executable, and new text still goes above them.
+
+#       ifdef CODEGEN_USE_MMAP
+
+            madvise(c->_base, c->_size, MADV_DONTNEED);
+
+#       endif
+
+            c->_text = c->_sealed;
+            c->_data = c->_size;
+        }
+
+    public:
+
+        arena(std::size_t chunk_size = 1 << 20) : _chunk_size(program::align(chunk_size)) { }
+
+        arena(const arena &) = delete;
+
+        arena &operator=(const arena &) = delete;
+
+        ~arena()
+        {
+            while (!_chunks.empty()) unmap(_chunks.back());
+        }
+
+        // The arena used by linkable_module::link() by default. It is never destroyed, so that the
+        // functions in static objects can safely outlive everything else.
+        static arena &shared()
+        {
+            static arena *a = new arena();
+            return *a;
+        }
+
+        // Ends with commit(), which throws program::exception if the pages cannot be made
+        // executable. A batch destroyed before it is committed, as when an exception leaves its
+        // scope, ends without throwing, and leaves the pages it could not seal to the next seal.
+        class batch
+        {
+            arena &_arena;
+            bool _open = true;
+
+        public:
+
+            batch(arena &a) : _arena(a)
+            {
+                std::lock_guard<std::mutex> lock(_arena._mutex);
+                ++_arena._batches;
+            }
+
+            batch(const batch &) = delete;
+
+            void commit()
+            {
+                if (!_open) return;
+                _open = false;
+                std::lock_guard<std::mutex> lock(_arena._mutex);
+                if (!--_arena._batches) _arena.seal();
+            }
+
+            ~batch() noexcept
+            {
+                try
+                {
+                    commit();
+                }
+                catch (const program::exception &)
+                {
+                }
+            }
+        };
+
+        program *link(const std::vector<byte> &text, const std::vector<byte> &data, std::size_t bss_size,
+            const std::function<void(byte *, byte *, byte *)> &reloc = [](byte *, byte *, byte *) {})
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::size_t data_size = program::align(data.size(), data_alignment) + bss_size;
+            std::size_t t, d;
+            chunk *c = _current;
+            if (!c || !fit(*c, text.size(), data_size, t, d))
+            {
+                std::size_t size = program::align(text.size()) + program::align(data_size + data_alignment);
+                // Anything large enough to waste a good part of a chunk gets one of its own.
+                if (size > _chunk_size / 4) c = new_chunk(size);
+                else
+                {
+                    if (_current && !_current->_live) unmap(_current);
+                    c = _current = new_chunk(_chunk_size);
+                }
+                fit(*c, text.size(), data_size, t, d);
+            }
+
+            if (c->_dirty == c->_size) _dirty_chunks.push_back(c);
+            c->_dirty = std::min(c->_dirty, t);
+
+            byte *bss = c->_base + d + program::align(data.size(), data_alignment);
+            std::copy(text.begin(), text.end(), c->_base + t);
+            std::copy(data.begin(), data.end(), c->_base + d);
+            std::fill(bss, bss + bss_size, 0);
+
+            block *b = new block(*this, c, c->_text, t, t + text.size(), d, c->_data);
+            c->_text = t + text.size();
+            c->_data = d;
+            ++c->_live;
+
+            reloc(c->_base + t, c->_base + d, bss);
+            if (!_batches) seal();
+            return b;
+        }
+
+        // the number of bytes mapped by the arena at the moment
+        std::size_t mapped()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _mapped;
+        }
+    };
+}
+
+#endif
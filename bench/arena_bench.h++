@@ -0,0 +1,71 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// Links the same small module (the 5 byte addition from README.md) many times, first giving each
+// function pages of its own like program does, then into an arena one at a time, and finally into
+// an arena in one batch.
+
+template<class T> struct standalone_module : linkable_module<T>
+{
+    standalone_module(const linkable_module<T> &m) : linkable_module<T>(m) { }
+
+    T link()
+    {
+        return T(new program(this->_text, this->_data, this->_bss_size));
+    }
+};
+
+BENCHMARK(Link)
+{
+    using fun = std::int_least32_t(std::int_least32_t, std::int_least32_t);
+
+    const int n = 20000;
+
+    x86::assembler a;
+    a(x86::MOV(x86::EAX, x86::EDI));
+    a(x86::ADD(x86::EAX, x86::ESI));
+    a(x86::RET());
+    auto m = a.assemble_function<fun>();
+    standalone_module<function<fun>> sm(m);
+
+    std::vector<function<fun>> funs;
+    funs.reserve(n);
+
+    auto measure = [&](const std::string &how, std::function<void()> link)
+    {
+        std::size_t rss = bench::rss();
+        double t = bench::time(link);
+        std::size_t grown = bench::rss() - rss;
+        if (funs[n - 1](19, 23) != 42) throw 0;
+        bench::report(benchmark_name, how + " functions/s", n / t, "1/s");
+        bench::report(benchmark_name, how + " RSS growth per function", (double)grown / n, "B");
+        funs.clear();
+    };
+
+    measure("own pages", [&] { for (int i = 0; i < n; ++i) funs.push_back(sm.link()); });
+
+    arena ar;
+    measure("arena", [&] { for (int i = 0; i < n; ++i) funs.push_back(m.link(ar)); });
+
+    arena ar2;
+    measure("arena batch", [&]
+    {
+        arena::batch b(ar2);
+        for (int i = 0; i < n; ++i) funs.push_back(m.link(ar2));
+    });
+}
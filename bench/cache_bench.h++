@@ -0,0 +1,69 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// Builds the same functions again and again, as a server regenerating the IR of its queries
+// would: without a cache, with one in memory, and from the files of an earlier run (a new cache
+// on the same directory, as in a restarted process).
+
+BENCHMARK(Cache)
+{
+    using fun = std::int64_t(std::int64_t, std::int64_t);
+
+    const int n = 2000;
+
+    std::vector<ir::code> codes;
+    for (int k = 0; k < n; ++k) codes.push_back(parallel_bench_function(k));
+
+    char directory[] = "/tmp/codegen_cache_bench_XXXXXX";
+    if (!mkdtemp(directory)) throw 0;
+
+    arena ar;
+    std::vector<function<fun>> funs;
+    funs.reserve(n);
+
+    bench::report(benchmark_name, "no cache", n / bench::time([&]
+    {
+        for (auto &code : codes) funs.push_back(build<fun>(code, ar));
+    }), "functions/s");
+    funs.clear();
+
+    {
+        code_cache cache(ar, directory);
+        bench::report(benchmark_name, "cold, saving files", n / bench::time([&]
+        {
+            for (auto &code : codes) funs.push_back(build<fun>(code, cache));
+        }), "functions/s");
+        funs.clear();
+        bench::report(benchmark_name, "hits in memory", n / bench::time([&]
+        {
+            for (auto &code : codes) funs.push_back(build<fun>(code, cache));
+        }), "functions/s");
+        funs.clear();
+    }
+
+    code_cache cache(ar, directory);
+    bench::report(benchmark_name, "warm, from files", n / bench::time([&]
+    {
+        for (auto &code : codes) funs.push_back(build<fun>(code, cache));
+    }), "functions/s");
+    if (cache.loads() != n || funs[n - 1](1, 2) != build<fun>(codes[n - 1], ar)(1, 2)) throw 0;
+    funs.clear();
+
+    for (auto &code : codes) std::remove(cache.file(code).c_str());
+    rmdir(directory);
+}
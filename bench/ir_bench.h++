@@ -0,0 +1,65 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// Compile throughput in IR nodes per second on synthetic straight line functions of growing size.
+// The throughput should stay about the same as the functions grow; if it drops, some pass does
+// more than a constant amount of work per node.
+
+ir::code ir_bench_function(int n)
+{
+    ir::code code;
+    auto i64 = code(ir::Int(-64));
+    auto fun = code(ir::Enter(code(ir::Fun(0, i64, i64, i64))));
+    auto x = code(ir::Arg(fun, 0));
+    auto y = code(ir::Arg(fun, 1));
+    auto t = x;
+    for (int i = 0; i < n; ++i)
+    {
+        t = code(ir::Add(t, y));
+        t = code(ir::Xor(t, x));
+    }
+    code(ir::Move(code(ir::RVal(fun)), t));
+    code(ir::Exit(fun));
+    return code;
+}
+
+BENCHMARK(IR)
+{
+    for (int n : { 1000, 10000, 100000 })
+    {
+        auto code = ir_bench_function(n);
+        double nodes = code.nodes().count();
+        std::string size = std::to_string((int)nodes) + " nodes";
+
+        ir::code rtl;
+        bench::report(benchmark_name, size + ": lower", nodes / bench::time([&]
+        {
+            ir::code pre_ra;
+            x86::cc<ir::code>::pre_ra_gen pre_ra_gen(pre_ra);
+            code.pass(pre_ra_gen);
+            rtl = x86::rtl<ir::code, 64>(pre_ra);
+        }), "nodes/s");
+
+        bench::report(benchmark_name, size + ": simplify x4", nodes / bench::time([&] { simplify(code, 4); }), "nodes/s");
+
+        // The text of the original code nests each pure node in its only use, so print the
+        // lowered code instead, where every value has a name.
+        double lowered = rtl.nodes().count();
+        bench::report(benchmark_name, size + ": text of lowered", lowered / bench::time([&] { rtl.text(); }), "nodes/s");
+    }
+}
@@ -0,0 +1,101 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// This is the benchmark program for my codegen library. Like the test program, it is one source
+// file including a header for each part of the library, and it has no dependencies apart from the
+// library itself. Each benchmark prints lines of the form
+//
+//     Benchmark  measurement  value unit
+//
+// to make it easy to compare the results of two runs with diff or a spreadsheet. The numbers are
+// meant to be compared with each other on the same machine, not as absolute truths.
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "../codegen.h++"
+#include "../textual.h++"
+
+using namespace codegen;
+
+namespace bench
+{
+    struct benchmark
+    {
+        static std::vector<std::pair<std::string, void (*)()>> &all()
+        {
+            static std::vector<std::pair<std::string, void (*)()>> benchmarks;
+            return benchmarks;
+        }
+
+        benchmark(const std::string &name, void (*run)())
+        {
+            all().emplace_back(name, run);
+        }
+    };
+
+    // Seconds spent running f once.
+    template<class F> double time(F f)
+    {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // The resident set size of the process in bytes, or 0 where we don't know how to find it.
+    std::size_t rss()
+    {
+        std::ifstream statm("/proc/self/statm");
+        std::size_t size, resident;
+        if (statm >> size >> resident) return resident * program::page_size();
+        return 0;
+    }
+
+    void report(const std::string &name, const std::string &what, double value, const std::string &unit)
+    {
+        std::cout << std::left << std::setw(24) << name << std::setw(40) << what
+            << std::right << std::setw(14) << std::fixed << std::setprecision(value < 100? 3 : 0) << value
+            << " " << unit << std::endl;
+    }
+}
+
+#define BENCHMARK(name) \
+    void bench_##name(const char *); \
+    static bench::benchmark bench_registration_##name(#name, [] { bench_##name(#name); }); \
+    void bench_##name(const char *benchmark_name)
+
+#include "../test/samples.h++"
+
+#include "arena_bench.h++"
+#include "ir_bench.h++"
+#include "ra_bench.h++"
+#include "parallel_bench.h++"
+#include "cache_bench.h++"
+#include "simplify_bench.h++"
+#include "simd_bench.h++"
+#include "textual_bench.h++"
+#include "profile_bench.h++"
+
+int main(int argc, char *argv[])
+{
+    for (auto &b : bench::benchmark::all())
+        if (argc < 2 || b.first.find(argv[1]) != std::string::npos) b.second();
+    return 0;
+}
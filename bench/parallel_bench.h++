@@ -0,0 +1,65 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// Compiles a few thousand small functions, like the fragments of queries a program might compile
+// when it starts, one build at a time and then in batches on more and more threads.
+
+ir::code parallel_bench_function(int k)
+{
+    ir::code code;
+    auto i64 = code(ir::Int(-64));
+    auto fun = code(ir::Enter(code(ir::Fun(0, i64, i64, i64))));
+    auto x = code(ir::Arg(fun, 0));
+    auto y = code(ir::Arg(fun, 1));
+    auto t = x;
+    for (int i = 0; i < 20; ++i) t = code(ir::Xor(code(ir::Add(t, y)), code(ir::Imm(k + i))));
+    code(ir::Move(code(ir::RVal(fun)), t));
+    code(ir::Exit(fun));
+    return code;
+}
+
+BENCHMARK(Parallel)
+{
+    using fun = std::int64_t(std::int64_t, std::int64_t);
+
+    const int n = 5000;
+
+    std::vector<ir::code> codes;
+    for (int k = 0; k < n; ++k) codes.push_back(parallel_bench_function(k));
+
+    {
+        arena ar;
+        std::vector<function<fun>> funs;
+        bench::report(benchmark_name, "one at a time", n / bench::time([&]
+        {
+            for (auto &code : codes) funs.push_back(build<fun>(code, ar));
+        }), "functions/s");
+    }
+
+    for (unsigned threads = 1; ; threads *= 2)
+    {
+        threads = std::min(threads, hardware_threads());
+        arena ar;
+        std::vector<function<fun>> funs;
+        bench::report(benchmark_name, "batch on " + std::to_string(threads) + " threads", n / bench::time([&]
+        {
+            funs = build<fun>(codes, ar, threads);
+        }), "functions/s");
+        if (threads == hardware_threads()) break;
+    }
+}
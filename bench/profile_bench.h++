@@ -0,0 +1,68 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// Compile throughput without profiling, with compile_stats, and also writing a perf map, on one
+// thread and on all of them, and the share of the compile time each stage took. Profiling should
+// not make compiling any slower.
+
+BENCHMARK(Profile)
+{
+    using fun = std::int64_t(std::int64_t, std::int64_t);
+    const int n = 2000;
+    std::vector<ir::code> codes;
+    for (int k = 0; k < n; ++k) codes.push_back(sample_chain(200, k % 2? 4 : 24));
+
+    compiler c;
+    auto run = [&](const std::string &what)
+    {
+        bench::report(benchmark_name, what, n / bench::time([&]
+        {
+            for (auto &code : codes) c.compile<fun>(code);
+        }), "functions/s");
+    };
+    run("off");
+    compile_stats stats;
+    c.profile(&stats);
+    run("compile_stats");
+    c.profile(nullptr);
+    run("off again");
+
+    for (int k = 0; k < compile_stats::nstages; ++k)
+        if (k != compile_stats::link)
+            bench::report(benchmark_name, std::string(compile_stats::stage_name(k)) + " share", 100 * stats._stages[k]._seconds / stats.seconds(), "%");
+
+    char directory[] = "/tmp/codegen_profile_bench_XXXXXX";
+    if (!mkdtemp(directory)) throw 0;
+    {
+        arena ar;
+        perf_map map(perf_map::map, directory);
+        c.perf(&map);
+        bench::report(benchmark_name, "build with perf map", n / bench::time([&]
+        {
+            for (auto &code : codes) c.build<fun>(code, ar);
+        }), "functions/s");
+        c.perf(nullptr);
+        bench::report(benchmark_name, "parallel build with both", n / bench::time([&]
+        {
+            compile_stats all;
+            build<fun>(codes, ar, &all, &map);
+        }), "functions/s");
+    }
+    std::remove((std::string(directory) + "/perf-" + std::to_string(getpid()) + ".map").c_str());
+    rmdir(directory);
+}
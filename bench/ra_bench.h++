@@ -0,0 +1,49 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// Register allocation throughput in RTL nodes per second, ra against linear_ra, on functions of
+// growing size where w values are live at a time. With w = 4 everything fits in registers, with
+// w = 24 a lot is spilled. The size of the machine code tells how good the allocation is, but only
+// for linear_ra, as gen cannot handle all of what ra leaves behind in these functions.
+
+BENCHMARK(RA)
+{
+    using F = std::int64_t(std::int64_t, std::int64_t);
+    for (int w : { 4, 24 })
+        for (int n : { 1000, 10000, 100000 })
+        {
+            ir::code pre_ra;
+            x86::cc<ir::code>::pre_ra_gen pre_ra_gen(pre_ra);
+            sample_chain(n, w).pass(pre_ra_gen);
+            ir::code rtl = x86::rtl<ir::code, 64>(pre_ra);
+            double nodes = rtl.nodes().count();
+            std::string size = std::to_string((int)nodes) + " nodes, w = " + std::to_string(w);
+
+            // The old allocator crashes on the bigger functions and whenever it has to spill, so it
+            // only gets the smallest ones that fit in registers
+            if (n <= 1000 && w == 4)
+            {
+                ir::code post_ra;
+                bench::report(benchmark_name, size + ": ra", nodes / bench::time([&] { ra<x86::regs64>().process(post_ra, rtl, 1); }), "nodes/s");
+            }
+
+            ir::code post_ra;
+            bench::report(benchmark_name, size + ": linear_ra", nodes / bench::time([&] { linear_ra<x86::regs64>().process(post_ra, rtl); }), "nodes/s");
+            bench::report(benchmark_name, size + ": linear_ra text", sample_text_size<F>(post_ra), "bytes");
+        }
+}
@@ -0,0 +1,68 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// Throughput of generated float kernels in elements per second, out[i] = a[i] * b[i] + c[i] over
+// arrays that fit in the L1 cache, one element at a time and in vectors of 4 and 8. The vectors of
+// 4 are run with SSE and with AVX, and the vectors of 8 only where the processor has AVX.
+
+ir::code simd_bench_kernel(int n)
+{
+    ir::code code;
+    auto f32 = code(ir::Float(2, -125, 128, 24)), i64 = code(ir::Int(-64)), space = code(ir::Imm(0));
+    auto vec = n > 1? code(ir::Array(f32, n)) : f32, p = code(ir::Ptr(vec));
+    auto fun = code(ir::Enter(code(ir::Fun(0, i64, p, p, p, p, i64))));
+    std::vector<ir::word> ptrs;
+    for (int k = 0; k < 4; ++k)
+    {
+        ptrs.push_back(code(ir::Temp(p)));
+        code(ir::Move(ptrs.back(), code(ir::Arg(fun, k))));
+    }
+    auto count = code(ir::Temp(i64)), a = code(ir::Temp(vec)), b = code(ir::Temp(vec)), c = code(ir::Temp(vec));
+    code(ir::Move(count, code(ir::Arg(fun, 4))));
+    auto top = code(ir::Label());
+    code(ir::Mark(top));
+    code(ir::Ld(a, ptrs[0], space, vec));
+    code(ir::Ld(b, ptrs[1], space, vec));
+    code(ir::Ld(c, ptrs[2], space, vec));
+    code(ir::St(ptrs[3], code(ir::Add(code(ir::Mul(a, b)), c)), space, vec));
+    for (auto ptr : ptrs) code(ir::Move(ptr, code(ir::Add(ptr, code(ir::Imm(4 * n))))));
+    code(ir::Move(count, code(ir::Sub(count, code(ir::Imm(1))))));
+    code(ir::Branch(top, code(ir::Gt(count, code(ir::Imm(0))))));
+    code(ir::Move(code(ir::RVal(fun)), code(ir::Imm(0))));
+    code(ir::Exit(fun));
+    return code;
+}
+
+BENCHMARK(SIMD)
+{
+    using F = std::int64_t(float *, float *, float *, float *, std::int64_t);
+    const int size = 1024, rounds = 100000;
+    std::vector<float> a(size, 1.5f), b(size, 0.25f), c(size, 2), out(size);
+    auto host = x86::features::host();
+    std::vector<std::pair<int, x86::features>> runs = { { 1, x86::features() }, { 4, x86::features() } };
+    if (host._avx) runs.insert(runs.end(), { { 4, host }, { 8, host } });
+    for (auto &run : runs)
+    {
+        compiler comp;
+        comp.target(run.second);
+        auto f = comp.build<F>(simd_bench_kernel(run.first), arena::shared());
+        double t = bench::time([&] { for (int i = 0; i < rounds; ++i) f(a.data(), b.data(), c.data(), out.data(), size / run.first); });
+        std::string what = run.first == 1? "scalar" : std::to_string(run.first) + " floats, " + (run.second._avx? "AVX" : "SSE");
+        bench::report(benchmark_name, what, (double)size * rounds / t, "elements/s");
+    }
+}
@@ -0,0 +1,83 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// Run time of loops compiled as they are, and after the loop optimizations in simplify.h++. The
+// inner loop of the second kernel has loop invariant products, a product of the induction
+// variables, and one depending on a conditionally incremented variable, which stays.
+
+const char *simplify_bench_single =
+    "[ i64: Int -64 ]"
+    "[ fun: Enter [ Fun 0 i64 i64 i64 ] ]"
+    "[ i: Temp i64 ] [ s: Temp i64 ]"
+    "[ Move i [ Cast i64 [ 0 ] ] ] [ Move s [ Cast i64 [ 0 ] ] ]"
+    "[ l: Forever ]"
+    "[ x: SkipIf [ Gte i [ Arg fun 0 ] ] ]"
+    "[ Move s [ Xor s [ Add [ Mul i [ Cast i64 [ 7 ] ] ] [ Mul [ Arg fun 1 ] [ Add [ Arg fun 1 ] [ Cast i64 [ 3 ] ] ] ] ] ] ]"
+    "[ Move s [ Add s [ Mul i [ Mul [ Arg fun 1 ] [ Arg fun 1 ] ] ] ] ]"
+    "[ Move i [ Add i [ Cast i64 [ 1 ] ] ] ]"
+    "[ Repeat l ]"
+    "[ Here x ]"
+    "[ Move [ RVal fun ] s ]"
+    "[ Exit fun ]";
+
+const char *simplify_bench_nested =
+    "[ i64: Int -64 ]"
+    "[ fun: Enter [ Fun 0 i64 i64 i64 ] ]"
+    "[ i: Temp i64 ] [ j: Temp i64 ] [ k: Temp i64 ] [ s: Temp i64 ]"
+    "[ Move i [ Cast i64 [ 0 ] ] ] [ Move k [ Cast i64 [ 0 ] ] ] [ Move s [ Cast i64 [ 1 ] ] ]"
+    "[ l1: Forever ]"
+    "[ x: SkipIf [ Gte i [ Arg fun 0 ] ] ]"
+    "[ Move j [ Cast i64 [ 0 ] ] ]"
+    "[ l2: Forever ]"
+    "[ y: SkipIf [ Gte j [ Arg fun 1 ] ] ]"
+    "[ Move s [ Add [ Add s [ Mul [ Add i [ Arg fun 1 ] ] [ Mul [ Arg fun 0 ] [ Arg fun 0 ] ] ] ] [ Mul j i ] ] ]"
+    "[ z: SkipIf [ Eq [ And j [ Cast i64 [ 1 ] ] ] [ Cast i64 [ 0 ] ] ] ]"
+    "[ Move k [ Add k [ Cast i64 [ 1 ] ] ] ]"
+    "[ Here z ]"
+    "[ Move s [ Xor s [ Mul k [ Cast i64 [ 5 ] ] ] ] ]"
+    "[ Move j [ Add j [ Cast i64 [ 1 ] ] ] ]"
+    "[ Repeat l2 ]"
+    "[ Here y ]"
+    "[ Move i [ Add i [ Cast i64 [ 1 ] ] ] ]"
+    "[ Repeat l1 ]"
+    "[ Here x ]"
+    "[ Move [ RVal fun ] s ]"
+    "[ Exit fun ]";
+
+BENCHMARK(Simplify)
+{
+    using F = std::int64_t(std::int64_t, std::int64_t);
+    struct kernel { const char *name, *text; std::int64_t a, b; double iterations; };
+    for (auto k : { kernel{ "single loop", simplify_bench_single, 20000000, 5, 2e7 }, kernel{ "nested loops", simplify_bench_nested, 5000, 4000, 2e7 } })
+    {
+        ir::code code = textual(k.text).code();
+        ir::code plain = control::unstructurized<ir::code>(code), optimized = control::unstructurized<ir::code>(optimize(code, 4));
+        auto f = build<F>(plain), g = build<F>(optimized);
+        // The best of a few runs, as a loop this short is easily disturbed
+        std::int64_t r = 0, s = 1;
+        double before = 1e9, after = 1e9;
+        for (int run = 0; run < 5; ++run)
+        {
+            before = std::min(before, bench::time([&] { r = f(k.a, k.b); }));
+            after = std::min(after, bench::time([&] { s = g(k.a, k.b); }));
+        }
+        if (r != s) std::cout << "different results from " << k.name << std::endl;
+        bench::report(benchmark_name, std::string(k.name) + ": as is", before * 1e9 / k.iterations, "ns/iteration");
+        bench::report(benchmark_name, std::string(k.name) + ": optimized", after * 1e9 / k.iterations, "ns/iteration");
+    }
+}
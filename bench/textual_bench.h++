@@ -0,0 +1,79 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// Parsing throughput in MB/s of a module of a few megabytes of textual IR, many functions each with
+// symbols of its own: textual against textual_stream, reading from memory, from a stream in chunks,
+// and from a mapped file.
+
+std::string textual_bench_module(int n)
+{
+    std::string text = "[ i64: Int -64 ]\n";
+    for (int k = 0; k < n; ++k)
+    {
+        std::string s = "_" + std::to_string(k);
+        text +=
+            "[ fun" + s + ": Enter [ Fun 0 i64 i64 i64 ] ]\n"
+            "[ i" + s + ": Temp i64 ] [ j" + s + ": Temp i64 ] [ sum" + s + ": Temp i64 ]  # loop variables\n"
+            "[ Move i" + s + " [ Cast i64 [ 0 ] ] ] [ Move sum" + s + " [ Cast i64 [ -1 ] ] ]\n"
+            "[ l" + s + ": Forever ]\n"
+            "[ x" + s + ": SkipIf [ Gte i" + s + " [ Arg fun" + s + " 0 ] ] ]\n"
+            "[ Move j" + s + " [ Mul [ Add i" + s + " [ Arg fun" + s + " 1 ] ] [ Cast i64 [ " + std::to_string(k * 7919) + " ] ] ] ]\n"
+            "[ Move sum" + s + " [ Xor sum" + s + " [ Sub j" + s + " [ Cast i64 [ 12345 ] ] ] ] ]\n"
+            "[ Move i" + s + " [ Add i" + s + " [ Cast i64 [ 1 ] ] ] ]\n"
+            "[ Repeat l" + s + " ]\n"
+            "[ Here x" + s + " ]\n"
+            "[ Move [ RVal fun" + s + " ] sum" + s + " ]\n"
+            "[ Exit fun" + s + " ]\n";
+    }
+    return text;
+}
+
+BENCHMARK(Textual)
+{
+    std::string text = textual_bench_module(10000);
+    double mb = text.size() / 1e6;
+    bench::report(benchmark_name, "input", mb, "MB");
+
+    ir::code expected;
+    bench::report(benchmark_name, "textual", mb / bench::time([&] { expected = textual(text).code(); }), "MB/s");
+
+    // The parser is reused, as a service parsing module after module would, so its buffers have
+    // grown to size before the runs measured
+    textual_stream parser;
+    ir::code warm;
+    parser.parse(warm, text);
+    auto run = [&](const std::string &what, std::function<void(ir::code &)> parse)
+    {
+        ir::code code;
+        bench::report(benchmark_name, what, mb / bench::time([&] { parse(code); }), "MB/s");
+        if (code.bytes() != expected.bytes()) throw 0;
+    };
+    run("textual_stream, memory", [&](ir::code &code) { parser.parse(code, text); });
+    run("textual_stream, chunks", [&](ir::code &code)
+    {
+        std::istringstream in(text);
+        parser.parse(code, in);
+    });
+
+    char path[] = "/tmp/codegen_textual_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1 || write(fd, text.data(), text.size()) != (ssize_t)text.size()) throw 0;
+    close(fd);
+    run("textual_stream, file", [&](ir::code &code) { parser.parse_file(code, path); });
+    std::remove(path);
+}
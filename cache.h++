@@ -0,0 +1,365 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef CODEGEN_CACHE_H
+#define CODEGEN_CACHE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "ir.h++"
+#include "x86_asm.h++"
+
+namespace codegen
+{
+    // A cache of compiled functions keyed by their IR. Building the same code again returns the
+    // function linked the first time, sharing its memory, without compiling anything. The key is a
+    // hash of the serialized nodes of the code and the target model, but a hit also compares the
+    // nodes themselves, so a collision only costs a compilation.
+    //
+    // Given a directory, the cache also keeps a file of each module it compiles there: the text,
+    // data, and bss size, and the relocations. Another cache, in this or a later process, links
+    // modules from those files instead of compiling them. The directory must exist. A file that
+    // cannot be written or read, or does not match the code, is treated as missing; it is never
+    // an error to lose the cache.
+    //
+    // The cache keeps the functions it has built alive until they are erased, evicted, or the cache
+    // is cleared or destroyed, so the arena must outlive it. With a capacity, the least recently
+    // used function is evicted whenever there are more than that many in memory. Its file stays in
+    // the directory. It can be used from many threads at a time; two threads building the same
+    // code at the same time may both compile it, but only one of the results is kept.
+    class code_cache
+    {
+        // Bump this whenever the code generated for the same IR changes, so that stale files are
+        // not used.
+        static constexpr std::uint64_t format = 1;
+
+        struct entry
+        {
+            std::uint64_t _key;
+            std::vector<byte> _ir;
+            program *_program;
+        };
+
+        arena &_arena;
+        std::string _directory;
+        std::size_t _capacity;
+        std::list<entry> _lru; // the most recently used first
+        std::unordered_map<std::uint64_t, std::vector<std::list<entry>::iterator>> _entries;
+        std::mutex _mutex;
+        std::size_t _hits = 0, _loads = 0, _misses = 0;
+        unsigned _temps = 0;
+
+        // FNV-1a
+        static std::uint64_t hash(std::uint64_t h, const byte *p, std::size_t n)
+        {
+            for (std::size_t i = 0; i < n; ++i) h = (h ^ p[i]) * 0x100000001b3;
+            return h;
+        }
+
+        static std::uint64_t key(const ir::code &code, const x86::features &features)
+        {
+            // The code compiled depends on the model and the instruction set extensions it is
+            // compiled for, so a cache directory shared between machines or compilers with other
+            // targets keeps their modules apart. Adding to the target description must add to this.
+            static_assert(sizeof(x86::model) == 1 && sizeof(x86::features) == 2, "a part of the target is missing from the cache key");
+            std::uint64_t target[] = { format, x86::model()._bits, features._avx, features._avx2 };
+            std::uint64_t h = hash(0xcbf29ce484222325, (const byte *)target, sizeof target);
+            return hash(h, code.bytes().data(), code.bytes().size());
+        }
+
+        std::list<entry>::iterator *find_entry(std::uint64_t k, const std::vector<byte> &ir)
+        {
+            auto e = _entries.find(k);
+            if (e != _entries.end()) for (auto &x : e->second) if (x->_ir == ir) return &x;
+            return nullptr;
+        }
+
+        // The program of the code, which is now the most recently used one, or null
+        program *find(std::uint64_t k, const std::vector<byte> &ir)
+        {
+            auto x = find_entry(k, ir);
+            if (!x) return nullptr;
+            _lru.splice(_lru.begin(), _lru, *x);
+            return (*x)->_program;
+        }
+
+        void erase(std::list<entry>::iterator x)
+        {
+            auto &bucket = _entries[x->_key];
+            bucket.erase(std::find(bucket.begin(), bucket.end(), x));
+            if (bucket.empty()) _entries.erase(x->_key);
+            x->_program->remove_ref();
+            _lru.erase(x);
+        }
+
+        // Adds a program, with the reference of the caller, unless another thread was quicker, in
+        // which case the program is released and the other one is returned. Either way the caller
+        // gets a new reference, taken before another thread can evict it.
+        program *add(std::uint64_t k, const std::vector<byte> &ir, program *p, bool loaded, bool *linked)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            ++(loaded? _loads : _misses);
+            if (program *q = find(k, ir))
+            {
+                p->remove_ref();
+                q->add_ref();
+                return q;
+            }
+            if (linked) *linked = true;
+            _lru.push_front({ k, ir, p });
+            _entries[k].push_back(_lru.begin());
+            p->add_ref();
+            if (_capacity && _lru.size() > _capacity) erase(std::prev(_lru.end()));
+            return p;
+        }
+
+        static void write(std::ostream &out, std::uint64_t x)
+        {
+            byte b[8];
+            for (int i = 0; i < 8; ++i) b[i] = x >> 8 * i;
+            out.write((const char *)b, 8);
+        }
+
+        static std::uint64_t read(std::istream &in)
+        {
+            byte b[8] = { };
+            in.read((char *)b, 8);
+            std::uint64_t x = 0;
+            for (int i = 0; i < 8; ++i) x |= (std::uint64_t)b[i] << 8 * i;
+            return x;
+        }
+
+        static void write(std::ostream &out, const std::vector<byte> &v)
+        {
+            write(out, v.size());
+            out.write((const char *)v.data(), v.size());
+        }
+
+        static bool read(std::istream &in, std::vector<byte> &v)
+        {
+            std::uint64_t n = read(in);
+            if (!in || n > 1 << 30) return false;
+            v.resize(n);
+            in.read((char *)v.data(), n);
+            return (bool)in;
+        }
+
+        static void write(std::ostream &out, const std::map<std::intptr_t, std::size_t> &globals)
+        {
+            write(out, globals.size());
+            for (auto &g : globals)
+            {
+                write(out, g.first);
+                write(out, g.second);
+            }
+        }
+
+        // The globals, which must all be within size bytes
+        static bool read(std::istream &in, std::map<std::intptr_t, std::size_t> &globals, std::size_t size)
+        {
+            for (auto n = read(in); in && n; --n)
+            {
+                std::intptr_t id = read(in);
+                std::uint64_t offset = read(in);
+                if (offset > size) return false;
+                globals[id] = offset;
+            }
+            return (bool)in;
+        }
+
+        void store(const std::string &file, const std::vector<byte> &ir, const module &m)
+        {
+            auto rel = dynamic_cast<const x86::reloc *>(m.relocations());
+            if (m.relocations() && !rel) return;
+
+            std::string temp;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                temp = file + "." + std::to_string(getpid()) + "." + std::to_string(_temps++);
+            }
+            std::ofstream out(temp, std::ios::binary);
+            write(out, format);
+            write(out, ir);
+            write(out, m.text());
+            write(out, m.data());
+            write(out, m.bss_size());
+
+            // The ids of the globals are only used to match the relocations to the globals.
+            static const std::map<std::intptr_t, std::size_t> none;
+            write(out, rel? rel->_text_globals : none);
+            write(out, rel? rel->_data_globals : none);
+            write(out, rel? rel->_bss_globals : none);
+            for (int i = 0; i < 2; ++i)
+            {
+                write(out, rel? rel->_entries[i].size() : 0);
+                if (rel) for (auto &e : rel->_entries[i])
+                {
+                    write(out, e._index);
+                    write(out, e._id);
+                    write(out, e._relative | e._nbytes << 1);
+                }
+            }
+            out.close();
+            if (!out || std::rename(temp.c_str(), file.c_str())) std::remove(temp.c_str());
+        }
+
+        template<class FUN> bool load(const std::string &file, const std::vector<byte> &ir, function_module<FUN> &m)
+        {
+            std::ifstream in(file, std::ios::binary);
+            std::vector<byte> stored, text, data;
+            if (!in || read(in) != format || !read(in, stored) || stored != ir || !read(in, text) || !read(in, data)) return false;
+            std::uint64_t bss_size = read(in);
+            if (!in || bss_size > 1 << 30) return false;
+
+            // Every size and offset is checked, so that a broken file makes a miss and not a
+            // module that fails to link or writes outside its memory.
+            auto rel = new x86::reloc();
+            bool ok = read(in, rel->_text_globals, text.size()) && read(in, rel->_data_globals, data.size()) && read(in, rel->_bss_globals, bss_size);
+            for (int i = 0; i < 2 && ok; ++i)
+                for (auto n = read(in); ok && in && n; --n)
+                {
+                    x86::reloc::entry e;
+                    std::uint64_t index = read(in);
+                    e._id = read(in);
+                    auto flags = read(in);
+                    e._index = index;
+                    e._relative = flags & 1;
+                    e._nbytes = flags >> 1;
+                    std::size_t size = i? data.size() : text.size();
+                    if (flags >> 1 > 8 || e._nbytes > size || index > size - e._nbytes) ok = false;
+                    if (!rel->_text_globals.count(e._id) && !rel->_data_globals.count(e._id) && !rel->_bss_globals.count(e._id)) ok = false;
+                    rel->_entries[i].push_back(e);
+                }
+            if (ok && in) m = function_module<FUN>(text, data, bss_size, rel);
+            if (!--rel->_refs) delete rel;
+            return ok && in;
+        }
+
+    public:
+
+        // A capacity of 0 keeps every function until the cache is cleared
+        code_cache(arena &a = arena::shared(), const std::string &directory = "", std::size_t capacity = 0)
+            : _arena(a), _directory(directory), _capacity(capacity) { }
+
+        code_cache(const std::string &directory, std::size_t capacity = 0) : code_cache(arena::shared(), directory, capacity) { }
+
+        code_cache(const code_cache &) = delete;
+
+        code_cache &operator=(const code_cache &) = delete;
+
+        ~code_cache()
+        {
+            clear();
+        }
+
+        // The file the module of the code is kept in, or an empty string if there is no directory
+        std::string file(const ir::code &code, const x86::features &target = x86::features::host()) const
+        {
+            if (_directory.empty()) return "";
+            std::stringstream ss;
+            ss << _directory << "/" << std::hex << std::setw(16) << std::setfill('0') << key(code, target) << ".cgc";
+            return ss.str();
+        }
+
+        // The function of the code from memory or the directory, or compile() linked and saved. The
+        // target is the one compile() compiles for. Linked, unless null, is set to whether the
+        // function returned was linked by this call, rather than found in memory.
+        template<class FUN, class F> function<FUN> get(const ir::code &code, F compile, const x86::features &target = x86::features::host(),
+            bool *linked = nullptr)
+        {
+            if (linked) *linked = false;
+            auto k = key(code, target);
+            auto &ir = code.bytes();
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (program *p = find(k, ir))
+                {
+                    ++_hits;
+                    p->add_ref();
+                    return function<FUN>(p);
+                }
+            }
+
+            auto file = this->file(code, target);
+            function_module<FUN> m;
+            bool loaded = !file.empty() && load(file, ir, m);
+            if (!loaded)
+            {
+                m = compile();
+                if (!file.empty()) store(file, ir, m);
+            }
+
+            return function<FUN>(add(k, ir, m.link_program(_arena), loaded, linked));
+        }
+
+        // Forgets the functions in memory. The ones still in use elsewhere stay alive, and the
+        // files stay in the directory.
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (auto &x : _lru) x._program->remove_ref();
+            _lru.clear();
+            _entries.clear();
+        }
+
+        // Forgets the function of the code in memory, if there is one, like clear()
+        bool erase(const ir::code &code, const x86::features &target = x86::features::host())
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto x = find_entry(key(code, target), code.bytes());
+            if (!x) return false;
+            erase(*x);
+            return true;
+        }
+
+        // The number of functions in memory
+        std::size_t size()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _lru.size();
+        }
+
+        // Functions found in memory, linked from files, and compiled
+        std::size_t hits()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _hits;
+        }
+
+        std::size_t loads()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _loads;
+        }
+
+        std::size_t misses()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _misses;
+        }
+    };
+}
+
+#endif
@@ -27,20 +27,183 @@
 #include "control.h++"
 #include "simplify.h++"
 #include "ra.h++"
+#include "parallel.h++"
+#include "cache.h++"
+#include "profile.h++"
 
 namespace codegen
 {
+    // The pipeline from IR to machine code. A compiler keeps its intermediate code and passes from
+    // one function to the next, so that compiling many functions does not allocate all of them
+    // anew each time. A compiler is not thread safe, but many of them can run at the same time,
+    // each on its own thread; build below keeps one for each worker thread.
+    //
+    // Profiling is off until the compiler is given stats to add to or a perf map to write to, and
+    // costs nothing but a test of a null pointer per stage until then.
+    class compiler
+    {
+        ir::code _pre_ra, _rewritten, _rtl, _post_ra;
+        linear_ra<x86::regs64> _ra;
+        x86::gen _gen;
+
+        compile_stats *_stats = nullptr;
+        perf_map *_perf = nullptr;
+
+        // Runs stage k, and adds its time and the size of the code it leaves to the stats
+        template<class F> void stage(int k, const ir::code *out, F f)
+        {
+            if (!_stats) return f();
+            auto start = std::chrono::steady_clock::now();
+            f();
+            auto &s = _stats->_stages[k];
+            s._seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (out)
+            {
+                s._nodes += out->nodes().count();
+                s._bytes += out->size();
+            }
+        }
+
+        void record(const ir::code &code, const module &m)
+        {
+            auto &s = *_stats;
+            ++s._functions;
+            s._nodes += code.nodes().count();
+            s._bytes += code.size();
+            auto ra = _ra.stats();
+            s._variables += ra._variables;
+            s._spilled += ra._spilled;
+            s._slot_words += ra._slot_words;
+            s._loads += ra._loads;
+            s._stores += ra._stores;
+            auto &nodes = _post_ra.nodes();
+            for (ir::word n = 0; n < nodes.count(); ++n)
+                if (nodes.id(n) == ir::node_id::RMove) ++s._rmoves;
+                else if (nodes.id(n) == ir::node_id::RSwap) ++s._rswaps;
+            s._instructions += _gen.assembly().instructions();
+            s._relaxation_rounds += _gen.assembly().relaxation_rounds();
+            s._text += m.text().size();
+            s._data += m.data().size();
+            s._bss += m.bss_size();
+        }
+
+    public:
+
+        // Adds the stats of the functions compiled from now on to stats, or stops if it is null
+        void profile(compile_stats *stats)
+        {
+            _stats = stats;
+        }
+
+        // Writes the functions built from now on to the perf map, or stops if it is null
+        void perf(perf_map *map)
+        {
+            _perf = map;
+        }
+
+        // The instruction set extensions to use, which are those of the host by default
+        void target(const x86::features &f)
+        {
+            _gen.target(f);
+        }
+
+        const x86::features &target() const
+        {
+            return _gen.target();
+        }
+
+        template<class FUN> function_module<FUN> compile(const ir::code &code)
+        {
+            _pre_ra.clear();
+            x86::cc<ir::code>::pre_ra_gen pre_ra_gen(_pre_ra);
+            stage(compile_stats::pre_ra, &_pre_ra, [&] { code.pass(pre_ra_gen); });
+            stage(compile_stats::rtl, &_rtl, [&] { x86::rtl<ir::code, 64>(_pre_ra, _rtl, _rewritten); });
+            _post_ra.clear();
+            stage(compile_stats::ra, &_post_ra, [&] { _ra.process(_post_ra, _rtl); });
+            _gen.clear();
+            stage(compile_stats::gen, nullptr, [&] { _post_ra.pass(_gen); });
+            if (!_stats) return _gen.module<FUN>();
+            function_module<FUN> m;
+            stage(compile_stats::assemble, nullptr, [&] { m = _gen.module<FUN>(); });
+            record(code, m);
+            return m;
+        }
+
+        // The name is the one the function gets in the perf map
+        template<class FUN> function<FUN> build(const ir::code &code, arena &a, const std::string &name = std::string())
+        {
+            if (!_stats && !_perf) return compile<FUN>(code).link(a);
+            auto m = compile<FUN>(code);
+            function<FUN> f;
+            stage(compile_stats::link, nullptr, [&] { f = m.link(a); });
+            if (_perf && !m.text().empty()) _perf->add(name, f.address(), m.text().size());
+            return f;
+        }
+
+        // Looks the code up in the cache first, and compiles it only if it is not there. Only the
+        // functions compiled are added to the stats, and only those linked anew, compiled or
+        // loaded from a file, are written to the perf map, which already has the others.
+        template<class FUN> function<FUN> build(const ir::code &code, code_cache &cache, const std::string &name = std::string())
+        {
+            bool linked;
+            auto f = cache.get<FUN>(code, [&] { return compile<FUN>(code); }, target(), &linked);
+            if (_perf && linked && f.text_size()) _perf->add(name, f.address(), f.text_size());
+            return f;
+        }
+    };
+
+    template<class FUN> function<FUN> build(ir::code &code, arena &a)
+    {
+        return compiler().build<FUN>(code, a);
+    }
+
     template<class FUN> function<FUN> build(ir::code &code)
     {
-        ir::code pre_ra;
-        x86::cc<ir::code>::pre_ra_gen pre_ra_gen(pre_ra);
-        code.pass(pre_ra_gen);
-        ir::code rtl = x86::rtl<ir::code, 64>(pre_ra);
-        ir::code post_ra;
-        ra<x86::regs64>().process(post_ra, rtl, 1);
-        x86::function_gen<FUN> gen;
-        post_ra.pass(gen);
-        return gen.fun();
+        return build<FUN>(code, arena::shared());
+    }
+
+    // Looks the code up in the cache first, and compiles it only if it is not there
+    template<class FUN> function<FUN> build(ir::code &code, code_cache &cache)
+    {
+        return compiler().build<FUN>(code, cache);
+    }
+
+    // Compiles the functions on threads threads (by default, as many as the hardware runs at a
+    // time) and links them into the arena in one batch. Each of the codes is only looked at by
+    // one thread, and the functions returned can be used, copied, and destroyed on any thread.
+    //
+    // The stats, unless null, are added those of all the functions. Each worker thread keeps
+    // stats of its own, so the seconds of a stage are those of all threads together. The perf
+    // map, unless null, gets every function.
+    template<class FUN> std::vector<function<FUN>> build(const std::vector<ir::code> &codes, arena &a, compile_stats *stats, perf_map *perf,
+        unsigned threads = hardware_threads())
+    {
+        std::vector<function<FUN>> funs(codes.size());
+        std::vector<compiler> compilers(std::min<std::size_t>(threads? threads : 1, codes.size()));
+        std::vector<compile_stats> worker_stats(stats? compilers.size() : 0);
+        for (std::size_t w = 0; w < compilers.size(); ++w)
+        {
+            if (stats) compilers[w].profile(&worker_stats[w]);
+            compilers[w].perf(perf);
+        }
+        arena::batch batch(a);
+        parallel_for(codes.size(), compilers.size(), [&](unsigned worker, std::size_t i)
+        {
+            funs[i] = compilers[worker].build<FUN>(codes[i], a);
+        });
+        batch.commit();
+        for (auto &s : worker_stats) *stats += s;
+        return funs;
+    }
+
+    template<class FUN> std::vector<function<FUN>> build(const std::vector<ir::code> &codes, arena &a, unsigned threads = hardware_threads())
+    {
+        return build<FUN>(codes, a, nullptr, nullptr, threads);
+    }
+
+    template<class FUN> std::vector<function<FUN>> build(const std::vector<ir::code> &codes, unsigned threads = hardware_threads())
+    {
+        return build<FUN>(codes, arena::shared(), threads);
     }
 }
 
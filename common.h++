@@ -25,6 +25,7 @@
 #include <map>
 #include <unordered_map>
 #include <set>
+#include <sstream>
 
 namespace codegen
 {
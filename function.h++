@@ -32,14 +32,14 @@ namespace codegen
 
     public:
 
-        function(const function &other)
+        function(const function &other) : _code(other._code), _offset(other._offset)
         {
-            *this = other;
+            if (_code) _code->add_ref();
         }
 
-        function(function &&other)
+        function(function &&other) : _code(other._code), _offset(other._offset)
         {
-            *this = other;
+            other._code = nullptr;
         }
 
         function(program *code = nullptr, std::size_t offset = 0)
@@ -53,6 +53,18 @@ namespace codegen
             if (_code) _code->remove_ref();
         }
 
+        // Where the machine code of the function is
+        const void *address() const
+        {
+            return (byte *)*_code + _offset;
+        }
+
+        // The bytes of machine code from the function to the end of the text it was linked with
+        std::size_t text_size() const
+        {
+            return _code? _code->text_bytes() - _offset : 0;
+        }
+
         R operator()(ARGS... args)
         {
             return reinterpret_cast<R(*)(ARGS...)>((byte *)*_code + _offset)(args...);
@@ -60,14 +72,17 @@ namespace codegen
 
         function &operator=(const function &other)
         {
+            if (other._code) other._code->add_ref();
+            if (_code) _code->remove_ref();
             _code = other._code;
             _offset = other._offset;
-            _code->add_ref();
             return *this;
         }
 
         function &operator=(function &&other)
         {
+            if (&other == this) return *this;
+            if (_code) _code->remove_ref();
             _code = other._code;
             _offset = other._offset;
             other._code = nullptr;
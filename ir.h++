@@ -16,6 +16,8 @@
     limitations under the License.
 */
 
+#include <limits>
+
 #include "common.h++"
 
 #ifndef CODEGEN_IR_H
@@ -103,9 +105,17 @@ namespace codegen
                 return _data.size();
             }
 
+            // The serialized nodes, for comparing and hashing whole buffers
+            const std::vector<byte> &bytes() const
+            {
+                return _data;
+            }
+
             void write(word x)
             {
-                std::uint_least64_t w = x < 0? (-x << 1) | 1 : x << 1;
+                // Negative words are their magnitude with the low bit set. The magnitude of the
+                // smallest one doesn't fit, so it is written as -0, which is otherwise unused.
+                std::uint_least64_t u = x, w = x < 0? (0 - u) << 1 | 1 : u << 1;
                 do
                 {
                     byte b = w & 0x7f;
@@ -140,7 +150,8 @@ namespace codegen
             {
                 std::uint_least64_t w = _data[pos] & 0x7f;
                 for (int i = 1; _data[pos++] & 0x80; ++i) w |= (std::uint_least64_t)(_data[pos] & 0x7f) << i * 7;
-                return w & 1? -(w >> 1) : w >> 1;
+                if (w == 1) return std::numeric_limits<word>::min();
+                return w & 1? -(word)(w >> 1) : (word)(w >> 1);
             }
 
             word read_at(word pos) const
@@ -210,6 +221,8 @@ namespace codegen
 
         template<class... ARGS> struct node_args
         {
+            static constexpr bool variadic = false;
+
             word operator[](unsigned) const
             {
                 // TODO: throw something sensible
@@ -230,6 +243,8 @@ namespace codegen
 
         template<> struct node_args<nothing>
         {
+            static constexpr bool variadic = false;
+
             node_args() { }
 
             word operator[](unsigned k) const
@@ -255,6 +270,8 @@ namespace codegen
 
         template<> struct node_args<word>
         {
+            static constexpr bool variadic = false;
+
             word _last;
 
             node_args() { }
@@ -298,6 +315,8 @@ namespace codegen
 
         template<> struct node_args<args>
         {
+            static constexpr bool variadic = true;
+
             args _args;
 
             node_args() { }
@@ -327,6 +346,8 @@ namespace codegen
 
         template<class... ARGS> struct node_args<word, ARGS...>
         {
+            static constexpr bool variadic = node_args<ARGS...>::variadic;
+
             word _first;
             node_args<ARGS...> _rest;
 
@@ -409,6 +430,7 @@ namespace codegen
         public: \
             template<class... ARGS> name_(ARGS... args) : _args(args...) { } \
             name_(const buffer &buf, word &pos, word nargs) { for (word i = 0; i < nargs; ++i) (*this)[i] = buf.read(pos); } \
+            name_(const word *args, word nargs) { for (word i = 0; i < nargs; ++i) (*this)[i] = args[i]; } \
             word id() const { return node_id::name_; } \
             word operator[](unsigned k) const { return _args[k]; } \
             word &operator[](unsigned k) { return _args[k]; } \
@@ -420,6 +442,8 @@ namespace codegen
 
         struct vnode
         {
+            virtual ~vnode() { }
+
             virtual word id() const = 0;
 
             virtual word operator[](unsigned k) const = 0;
@@ -472,13 +496,307 @@ namespace codegen
             }
         };
 
+        // The uses of a node, as positions in the order they were written
+        class use_list
+        {
+            const std::vector<word> *_pos;
+            const std::vector<std::uint32_t> *_next;
+            std::uint32_t _first;
+
+        public:
+
+            enum : std::uint32_t { none = 0xffffffff };
+
+            class iterator
+            {
+                const use_list *_list;
+                std::uint32_t _k;
+
+            public:
+
+                iterator(const use_list *list, std::uint32_t k) : _list(list), _k(k) { }
+
+                word operator*() const
+                {
+                    return (*_list->_pos)[_k];
+                }
+
+                iterator &operator++()
+                {
+                    _k = (*_list->_next)[_k];
+                    return *this;
+                }
+
+                bool operator!=(const iterator &other) const
+                {
+                    return _k != other._k;
+                }
+            };
+
+            use_list(const std::vector<word> &pos, const std::vector<std::uint32_t> &next, std::uint32_t first)
+                : _pos(&pos), _next(&next), _first(first) { }
+
+            iterator begin() const
+            {
+                return iterator(this, _first);
+            }
+
+            iterator end() const
+            {
+                return iterator(this, none);
+            }
+
+            bool empty() const
+            {
+                return _first == none;
+            }
+        };
+
+        // The nodes of a code buffer decoded into flat arrays, so that a node and its arguments can
+        // be found by position in constant time, without decoding varints or allocating anything.
+        // Nodes are numbered in the order they appear in the buffer. The code adds each node to its
+        // index as the node is written, so the index never changes while the code is only being
+        // read, and all passes reading the same code, on any thread, share it. Arguments always
+        // refer to nodes written before, so the type of each node and the lists of uses of its
+        // arguments are complete as soon as it is added.
+        class node_index
+        {
+            std::vector<word> _pos;
+            std::vector<std::uint32_t> _number; // of the node at each byte of the buffer
+            std::vector<std::uint8_t> _id;
+            std::vector<std::uint32_t> _first_arg = { 0 };
+            std::vector<word> _args;
+            std::vector<word> _types;
+            word _size = 0;
+
+            // Def-use lists: the first and last use of each node, and for each use, its position
+            // and the next use of the same node
+            std::vector<std::uint32_t> _first_use, _last_use;
+            std::vector<word> _use_pos;
+            std::vector<std::uint32_t> _next_use;
+
+            static bool is_arithmetic(word id)
+            {
+                switch (id)
+                {
+#               define X(base,name,...) case node_id::name: return std::is_base_of<arithmetic, name>::value;
+#               include "ir_nodes.def"
+                    default: return false;
+                }
+            }
+
+            static bool is_compare(word id)
+            {
+                switch (id)
+                {
+#               define X(base,name,...) case node_id::name: return std::is_base_of<compare, name>::value;
+#               include "ir_nodes.def"
+                    default: return false;
+                }
+            }
+
+            bool is_node(word pos) const
+            {
+                return pos >= 0 && pos < _size && _pos[_number[pos]] == pos;
+            }
+
+            // the type of the node at pos, or -1 if there is none
+            word type_at(word pos) const
+            {
+                return is_node(pos)? _types[number(pos)] : -1;
+            }
+
+            // argument k of the type ty, like the return type of a Fun
+            word type_arg(word ty, word k) const
+            {
+                if (!is_node(ty)) return -1;
+                word n = number(ty);
+                return k >= 0 && k < nargs(n)? arguments(n)[k] : -1;
+            }
+
+            word find_type(word pos, word id, const word *args) const
+            {
+                switch (id)
+                {
+                    case node_id::Temp:
+                    case node_id::Enter:
+                    case node_id::Conv:
+                    case node_id::Cast:
+                        return args[0];
+                    case node_id::Reg:
+                        return type_at(args[0]);
+                    case node_id::RVal:
+                        return type_arg(type_at(args[0]), 1);
+                    case node_id::Arg:
+                        return type_arg(type_at(args[0]), 2 + args[1]);
+                    default:
+                        if (is_compare(id)) return pos;
+                        if (is_arithmetic(id)) return type_at(args[0]);
+                        return -1;
+                }
+            }
+
+        public:
+
+            static bool is_id(word id, word k)
+            {
+                switch (id)
+                {
+#               define X(base,name,...) case node_id::name: return node_args<__VA_ARGS__>::is_id(k);
+#               include "ir_nodes.def"
+                    default: return false;
+                }
+            }
+
+            static bool is_pure(word id)
+            {
+                switch (id)
+                {
+#               define X(base,name,...) case node_id::name: return std::is_base_of<purenode, name>::value;
+#               include "ir_nodes.def"
+                    default: return false;
+                }
+            }
+
+            static bool is_write(word id)
+            {
+                switch (id)
+                {
+#               define X(base,name,...) case node_id::name: return std::is_base_of<wrnode, name>::value;
+#               include "ir_nodes.def"
+                    default: return false;
+                }
+            }
+
+            // The number of arguments of a node, or the least number of them for the nodes whose
+            // last arguments are a list
+            static word min_nargs(word id)
+            {
+                switch (id)
+                {
+#               define X(base,name,...) case node_id::name: return name().nargs();
+#               include "ir_nodes.def"
+                    default: return 0;
+                }
+            }
+
+            static bool is_variadic(word id)
+            {
+                switch (id)
+                {
+#               define X(base,name,...) case node_id::name: return node_args<__VA_ARGS__>::variadic;
+#               include "ir_nodes.def"
+                    default: return false;
+                }
+            }
+
+            static const char *name(word id)
+            {
+                switch (id)
+                {
+#               define X(base,name,...) case node_id::name: return #name;
+#               include "ir_nodes.def"
+                    default: return "";
+                }
+            }
+
+            // Adds the node just written at pos to the index.
+            void add(const buffer &buf, word pos)
+            {
+                word at = pos;
+                word nargs = buf.read(pos);
+                word id = buf.read(pos);
+                _pos.push_back(at);
+                _id.push_back(id);
+                for (word i = 0; i < nargs; ++i) _args.push_back(buf.read(pos));
+                _first_arg.push_back(_args.size());
+                word n = count() - 1;
+                _types.push_back(find_type(at, id, arguments(n)));
+                for (word k = 0; k < nargs; ++k)
+                {
+                    word arg = arguments(n)[k];
+                    if (!is_id(id, k) || !is_node(arg)) continue;
+                    word d = _number[arg];
+                    std::uint32_t u = _use_pos.size();
+                    _use_pos.push_back(at);
+                    _next_use.push_back(use_list::none);
+                    if (_first_use[d] == use_list::none) _first_use[d] = u;
+                    else _next_use[_last_use[d]] = u;
+                    _last_use[d] = u;
+                }
+                _first_use.push_back(use_list::none);
+                _last_use.push_back(use_list::none);
+                _number.resize(buf.size(), n);
+                _size = buf.size();
+            }
+
+            // Empties the index, keeping its storage for the next code
+            void clear()
+            {
+                _pos.clear();
+                _number.clear();
+                _id.clear();
+                _first_arg.resize(1);
+                _args.clear();
+                _types.clear();
+                _size = 0;
+                _first_use.clear();
+                _last_use.clear();
+                _use_pos.clear();
+                _next_use.clear();
+            }
+
+            word count() const
+            {
+                return _pos.size();
+            }
+
+            // The number of the node at pos, or of the node pos is inside of
+            word number(word pos) const
+            {
+                return _number[pos];
+            }
+
+            word pos(word n) const
+            {
+                return n < count()? _pos[n] : _size;
+            }
+
+            word id(word n) const
+            {
+                return _id[n];
+            }
+
+            word nargs(word n) const
+            {
+                return _first_arg[n + 1] - _first_arg[n];
+            }
+
+            const word *arguments(word n) const
+            {
+                return _args.data() + _first_arg[n];
+            }
+
+            // The type of the node, or -1 if it has none
+            word type(word n) const
+            {
+                return _types[n];
+            }
+
+            // The positions of the nodes using node n as an argument, in order
+            use_list uses(word n) const
+            {
+                return use_list(_use_pos, _next_use, _first_use[n]);
+            }
+        };
+
         class code;
 
         struct skip_query
         {
             using rval = int;
 
-            template<class NODE> rval operator()(const code &, word, const NODE &node) const { }
+            template<class NODE> rval operator()(const code &, word, const NODE &node) const { return 0; }
         };
 
         struct vnode_query
@@ -494,6 +812,7 @@ namespace codegen
         class code
         {
             buffer _buf;
+            node_index _index;
 
         public:
 
@@ -504,6 +823,20 @@ namespace codegen
                 _buf.write(node.id());
                 for (unsigned i = 0; i < node.nargs(); ++i) _buf.write(node[i]);
                 _buf.write(_buf.size() - pos);
+                _index.add(_buf, pos);
+                return pos;
+            }
+
+            // A node from its id and arguments, for readers that have them in an array and not as
+            // a node object
+            word operator()(word id, const word *args, word nargs)
+            {
+                word pos = _buf.size();
+                _buf.write(nargs);
+                _buf.write(id);
+                for (word i = 0; i < nargs; ++i) _buf.write(args[i]);
+                _buf.write(_buf.size() - pos);
+                _index.add(_buf, pos);
                 return pos;
             }
 
@@ -539,7 +872,20 @@ namespace codegen
 
             template<class F> auto query_at(const F &f, word index) const -> typename F::rval
             {
-                return query(f, index);
+                auto &nodes = this->nodes();
+                word n = nodes.number(index);
+                typename F::rval r;
+                switch (nodes.id(n))
+                {
+#               define X(base,name,...) case node_id::name: \
+                    r = f(*this, index, name(nodes.arguments(n), nodes.nargs(n))); \
+                    break;
+#               include "ir_nodes.def"
+                    default:
+                        // TODO: throw something
+                        ;
+                }
+                return r;
             }
 
             vnode *read(word &index) const
@@ -554,18 +900,19 @@ namespace codegen
 
             bool next(word &index) const
             {
-                query(skip_query(), index);
+                auto &nodes = this->nodes();
+                index = nodes.pos(nodes.number(index) + 1);
                 return index < size();
             }
 
             template<class F> void forward(F &f, word index) const
             {
-                word pos = index;
-                word nargs = _buf.read(index);
-                switch (_buf.read(index))
+                auto &nodes = this->nodes();
+                word n = nodes.number(index);
+                switch (nodes.id(n))
                 {
 #               define X(base,name,...) case node_id::name: \
-                    f(pos, name(_buf, index, nargs)); \
+                    f(index, name(nodes.arguments(n), nodes.nargs(n))); \
                     break;
 #               include "ir_nodes.def"
                     default:
@@ -598,12 +945,23 @@ namespace codegen
 
             template<class F> void pass_at(F &f, word index) const
             {
-                return pass(f, index);
+                auto &nodes = this->nodes();
+                word n = nodes.number(index);
+                switch (nodes.id(n))
+                {
+#               define X(base,name,...) case node_id::name: \
+                    f(*this, index, name(nodes.arguments(n), nodes.nargs(n))); \
+                    break;
+#               include "ir_nodes.def"
+                    default:
+                        // TODO: throw something
+                        ;
+                }
             }
 
             template<class F> void pass_temp(F f, word index) const
             {
-                return pass(f, index);
+                return pass_at(f, index);
             }
 
             bool prev(ir::word &pos) const
@@ -620,11 +978,18 @@ namespace codegen
 
             word arg(word index, word k) const
             {
-                _buf.read(index);
-                _buf.read(index);
-                word x = _buf.read(index);
-                while (k--) x = _buf.read(index);
-                return x;
+                auto &nodes = this->nodes();
+                return nodes.arguments(nodes.number(index))[k];
+            }
+
+            const node_index &nodes() const
+            {
+                return _index;
+            }
+
+            use_list uses(word index) const
+            {
+                return _index.uses(_index.number(index));
             }
 
             word size() const
@@ -632,9 +997,15 @@ namespace codegen
                 return _buf.size();
             }
 
+            const std::vector<byte> &bytes() const
+            {
+                return _buf.bytes();
+            }
+
             void clear()
             {
                 _buf.clear();
+                _index.clear();
             }
 
         private:
@@ -642,27 +1013,23 @@ namespace codegen
             std::string node_text(word pos, const std::set<word> &onedef, std::map<word, word> &symmap, unsigned depth = 0) const
             {
                 std::stringstream ss;
-                auto &n = *read_at(pos);
+                auto &nodes = this->nodes();
+                word n = nodes.number(pos), id = nodes.id(n);
+                const word *args = nodes.arguments(n);
                 ss << "[ ";
                 auto sym = symmap.find(pos);
-                if (sym != symmap.end()) ss << n.name() << "_" << sym->second << ": ";
-                ss << n.name() << std::endl;
-                for (unsigned i = 0; i < n.nargs(); ++i)
+                if (sym != symmap.end()) ss << node_index::name(id) << "_" << sym->second << ": ";
+                ss << node_index::name(id) << std::endl;
+                for (word i = 0; i < nodes.nargs(n); ++i)
                 {
                     ss << std::string(depth * 2 + 2, ' ');
-                    if (n.is_id(i))
-                        if (onedef.count(n[i])) ss << node_text(n[i], onedef, symmap, depth + 1);
-                        else
-                        {
-                            auto r = read_at(n[i]);
-                            ss << r->name() << "_" << symmap[n[i]] << std::endl;
-                            delete r;
-                        }
+                    if (node_index::is_id(id, i))
+                        if (onedef.count(args[i])) ss << node_text(args[i], onedef, symmap, depth + 1);
+                        else ss << node_index::name(nodes.id(nodes.number(args[i]))) << "_" << symmap[args[i]] << std::endl;
                     else
-                        ss << n[i] << std::endl;
+                        ss << args[i] << std::endl;
                 }
                 ss << std::string(depth * 2, ' ') << ']' << std::endl;
-                delete &n;
                 return ss.str();
             }
 
@@ -674,33 +1041,31 @@ namespace codegen
                 std::set<word> onedef;
                 std::map<word, word> symmap;
                 std::map<word, word> idmap;
-                for (word pos = 0; pos < size(); )
+                auto &nodes = this->nodes();
+                for (word n = 0; n < nodes.count(); ++n)
                 {
-                    auto &n = *read(pos);
-                    for (unsigned i = 0; i < n.nargs(); ++i)
-                        if (n.is_id(i) && !symmap.count(n[i]))
+                    const word *args = nodes.arguments(n);
+                    for (word i = 0; i < nodes.nargs(n); ++i)
+                        if (node_index::is_id(nodes.id(n), i) && !symmap.count(args[i]))
                         {
-                            auto r = read_at(n[i]);
-                            if (r->is_pure())
+                            word r = nodes.id(nodes.number(args[i]));
+                            if (node_index::is_pure(r))
                             {
-                                auto od = onedef.find(n[i]);
+                                auto od = onedef.find(args[i]);
                                 if (od == onedef.end())
                                 {
-                                    onedef.insert(n[i]);
-                                    delete r;
+                                    onedef.insert(args[i]);
                                     continue;
                                 }
                                 else onedef.erase(od);
                             }
                             word id;
-                            if (idmap.count(r->id())) id = ++idmap[r->id()];
-                            else idmap[r->id()] = id = 0;
-                            symmap[n[i]] = id;
-                            delete r;
+                            if (idmap.count(r)) id = ++idmap[r];
+                            else idmap[r] = id = 0;
+                            symmap[args[i]] = id;
                         }
-                    delete &n;
                 }
-                for (word pos = 0; pos < size(); next(pos) ) if (!onedef.count(pos)) ss << node_text(pos, onedef, symmap);
+                for (word n = 0; n < nodes.count(); ++n) if (!onedef.count(nodes.pos(n))) ss << node_text(nodes.pos(n), onedef, symmap);
                 return ss.str();
             }
         };
@@ -20,6 +20,7 @@
 #define CODEGEN_MODULE_H
 
 #include "function.h++"
+#include "arena.h++"
 
 namespace codegen
 {
@@ -29,7 +30,7 @@ namespace codegen
 
         struct reloc
         {
-            unsigned _refs = 1;
+            std::atomic<unsigned> _refs { 1 };
 
             virtual ~reloc() { }
 
@@ -89,6 +90,39 @@ namespace codegen
         {
             if (_reloc && !--_reloc->_refs) delete _reloc;
         }
+
+        const std::vector<byte> &text() const
+        {
+            return _text;
+        }
+
+        const std::vector<byte> &data() const
+        {
+            return _data;
+        }
+
+        std::size_t bss_size() const
+        {
+            return _bss_size;
+        }
+
+        const reloc *relocations() const
+        {
+            return _reloc;
+        }
+
+        // Links the module into the arena. The reference to the program is the caller's.
+        program *link_program(arena &a) const
+        {
+            if (!_reloc) return a.link(_text, _data, _bss_size);
+            auto reloc = [&](byte *text, byte *data, byte *bss)
+            {
+                std::map<std::intptr_t, byte *> mapping;
+                _reloc->resolve(mapping, text, data, bss);
+                _reloc->write(text, data, mapping);
+            };
+            return a.link(_text, _data, _bss_size, reloc);
+        }
     };
 
     template<class T> struct linkable_module : module
@@ -103,16 +137,14 @@ namespace codegen
             if (_reloc = reloc) ++reloc->_refs;
         }
 
+        T link(arena &a)
+        {
+            return T(this->link_program(a));
+        }
+
         T link()
         {
-            if (!_reloc) return T(new program(_text, _data, _bss_size));
-            auto reloc = [&](byte *text, byte *data, byte *bss)
-            {
-                std::map<std::intptr_t, byte *> mapping;
-                _reloc->resolve(mapping, text, data, bss);
-                _reloc->write(text, data, mapping);
-            };
-            return T(new program(_text, _data, _bss_size, reloc));
+            return link(arena::shared());
         }
     };
 
@@ -0,0 +1,142 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef CODEGEN_PARALLEL_H
+#define CODEGEN_PARALLEL_H
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace codegen
+{
+    // The number of threads the hardware runs at a time, at least 1
+    inline unsigned hardware_threads()
+    {
+        unsigned n = std::thread::hardware_concurrency();
+        return n? n : 1;
+    }
+
+    // Calls f(worker, i) for each i in 0..n-1 on up to threads threads, the calling thread being
+    // worker 0. Each worker starts with an equal, contiguous share of the indices and takes them
+    // from the front of its share one by one. A worker out of work steals the back half of the
+    // largest share left, so uneven work evens out without any shared queue to contend for.
+    //
+    // The worker is below threads, so that state of its own can be kept in a vector indexed by it.
+    // If f throws, no more indices are started, and the first exception is rethrown here once all
+    // the workers are done. If fewer threads can be started than asked for, the ones that did
+    // start steal the work of the others.
+    template<class F> void parallel_for(std::size_t n, unsigned threads, F f)
+    {
+        struct share
+        {
+            std::mutex _mutex;
+            std::size_t _next, _end;
+        };
+
+        if (!threads) threads = 1;
+        if (threads > n) threads = n? n : 1;
+        std::unique_ptr<share[]> shares(new share[threads]);
+        for (unsigned w = 0; w < threads; ++w)
+        {
+            shares[w]._next = n * w / threads;
+            shares[w]._end = n * (w + 1) / threads;
+        }
+
+        std::atomic<bool> failed(false);
+        std::exception_ptr error;
+        std::mutex error_mutex;
+
+        auto take = [&](unsigned w, std::size_t &i)
+        {
+            {
+                std::lock_guard<std::mutex> lock(shares[w]._mutex);
+                if (shares[w]._next < shares[w]._end)
+                {
+                    i = shares[w]._next++;
+                    return true;
+                }
+            }
+            for (;;)
+            {
+                unsigned victim = threads;
+                std::size_t most = 0;
+                for (unsigned v = 0; v < threads; ++v)
+                {
+                    std::lock_guard<std::mutex> lock(shares[v]._mutex);
+                    if (shares[v]._end - shares[v]._next > most)
+                    {
+                        most = shares[v]._end - shares[v]._next;
+                        victim = v;
+                    }
+                }
+                if (victim == threads) return false;
+
+                std::size_t from, to;
+                {
+                    std::lock_guard<std::mutex> lock(shares[victim]._mutex);
+                    auto &s = shares[victim];
+                    if (s._next == s._end) continue;
+                    to = s._end;
+                    from = s._end -= (s._end - s._next + 1) / 2;
+                }
+                std::lock_guard<std::mutex> lock(shares[w]._mutex);
+                i = from;
+                shares[w]._next = from + 1;
+                shares[w]._end = to;
+                return true;
+            }
+        };
+
+        auto work = [&](unsigned w)
+        {
+            std::size_t i;
+            while (!failed && take(w, i))
+                try
+                {
+                    f(w, i);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error) error = std::current_exception();
+                    failed = true;
+                }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned w = 1; w < threads; ++w)
+            try
+            {
+                workers.emplace_back(work, w);
+            }
+            catch (const std::system_error &)
+            {
+                break;
+            }
+        work(0);
+        for (auto &t : workers) t.join();
+        if (error) std::rethrow_exception(error);
+    }
+}
+
+#endif
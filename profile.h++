@@ -0,0 +1,255 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef CODEGEN_PROFILE_H
+#define CODEGEN_PROFILE_H
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "common.h++"
+
+namespace codegen
+{
+    // What compiling took, stage by stage, as a compiler given one records it (compiler::profile).
+    // The stats of each function compiled are added up, so to see a single function, give the
+    // compiler fresh stats before compiling it. The nodes and bytes of a stage are those of the IR
+    // it leaves behind, and those of the compiler are those of the IR it is given; gen and assemble
+    // leave instructions and machine code, counted below them.
+    struct compile_stats
+    {
+        enum { pre_ra, rtl, ra, gen, assemble, link, nstages };
+
+        static const char *stage_name(int k)
+        {
+            static const char *names[nstages] = { "pre_ra_gen", "rtl", "ra", "gen", "assemble", "link" };
+            return names[k];
+        }
+
+        struct stage
+        {
+            double _seconds = 0;
+            std::size_t _nodes = 0, _bytes = 0;
+        };
+
+        std::size_t _functions = 0, _nodes = 0, _bytes = 0;
+        stage _stages[nstages];
+
+        // Register allocation: loads and stores are those of spilled variables, and the RMoves and
+        // RSwaps are those left in the code for gen
+        std::size_t _variables = 0, _spilled = 0, _slot_words = 0, _loads = 0, _stores = 0, _rmoves = 0, _rswaps = 0;
+
+        // Assembly
+        std::size_t _instructions = 0, _relaxation_rounds = 0, _text = 0, _data = 0, _bss = 0;
+
+        double seconds() const
+        {
+            double t = 0;
+            for (auto &s : _stages) t += s._seconds;
+            return t;
+        }
+
+        compile_stats &operator+=(const compile_stats &other)
+        {
+            _functions += other._functions;
+            _nodes += other._nodes;
+            _bytes += other._bytes;
+            for (int k = 0; k < nstages; ++k)
+            {
+                _stages[k]._seconds += other._stages[k]._seconds;
+                _stages[k]._nodes += other._stages[k]._nodes;
+                _stages[k]._bytes += other._stages[k]._bytes;
+            }
+            _variables += other._variables;
+            _spilled += other._spilled;
+            _slot_words += other._slot_words;
+            _loads += other._loads;
+            _stores += other._stores;
+            _rmoves += other._rmoves;
+            _rswaps += other._rswaps;
+            _instructions += other._instructions;
+            _relaxation_rounds += other._relaxation_rounds;
+            _text += other._text;
+            _data += other._data;
+            _bss += other._bss;
+            return *this;
+        }
+
+        void write(std::ostream &out) const
+        {
+            out << _functions << " functions, " << _nodes << " nodes, " << _bytes << " bytes of IR\n";
+            for (int k = 0; k < nstages; ++k)
+            {
+                out << std::left << std::setw(12) << stage_name(k) << std::right << std::fixed << std::setprecision(6)
+                    << std::setw(12) << _stages[k]._seconds << " s";
+                if (_stages[k]._nodes) out << std::setw(10) << _stages[k]._nodes << " nodes" << std::setw(10) << _stages[k]._bytes << " bytes";
+                out << "\n";
+            }
+            out << "ra: " << _variables << " variables, " << _spilled << " spilled in " << _slot_words << " words, "
+                << _loads << " loads, " << _stores << " stores, " << _rmoves << " RMoves, " << _rswaps << " RSwaps\n";
+            out << "assembler: " << _instructions << " instructions, " << _relaxation_rounds << " relaxation rounds, "
+                << _text << " bytes of text, " << _data << " of data, " << _bss << " of bss\n";
+        }
+    };
+
+    // Tells perf the names of compiled functions, so that it attributes the samples taken in them
+    // to those names instead of unknown addresses. The perf map is the text file perf-<pid>.map,
+    // which perf report reads from /tmp by itself. The jitdump is the binary file jit-<pid>.dump,
+    // which also has the machine code, for perf inject --jit to make the functions look like a
+    // shared library, so that perf annotate works on them too. It is only written on Linux, and
+    // needs perf record -k mono, as its time stamps are those of the monotonic clock.
+    class perf_map
+    {
+    public:
+
+        enum format { map, jitdump };
+
+        struct file_error
+        {
+            std::string _path;
+        };
+
+    private:
+
+        std::FILE *_file;
+        format _format;
+        std::mutex _mutex;
+        std::uint64_t _index = 0;
+        void *_marker = nullptr;
+
+        struct jitdump_header
+        {
+            std::uint32_t _magic, _version, _size, _elf_mach, _pad, _pid;
+            std::uint64_t _timestamp, _flags;
+        };
+
+        struct jitdump_load
+        {
+            std::uint32_t _id, _size;
+            std::uint64_t _timestamp;
+            std::uint32_t _pid, _tid;
+            std::uint64_t _vma, _code_addr, _code_size, _code_index;
+        };
+
+        static std::uint64_t timestamp()
+        {
+
+#       ifdef __linux__
+
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+#       else
+
+            return 0;
+
+#       endif
+
+        }
+
+    public:
+
+        perf_map(format f = map, const std::string &directory = "/tmp") : _format(f)
+        {
+
+#       ifdef __linux__
+
+            auto pid = getpid();
+            std::string path = directory + (f == map? "/perf-" : "/jit-") + std::to_string(pid) + (f == map? ".map" : ".dump");
+            _file = std::fopen(path.c_str(), f == map? "a" : "w+b");
+            if (!_file) throw file_error { path };
+            if (f == jitdump)
+            {
+                jitdump_header h { 0x4a695444, 1, sizeof(jitdump_header), 62, 0, (std::uint32_t)pid, timestamp(), 0 };
+                std::fwrite(&h, sizeof h, 1, _file);
+                std::fflush(_file);
+                // perf record finds the file by this mapping of it
+                _marker = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, fileno(_file), 0);
+                if (_marker == MAP_FAILED) _marker = nullptr;
+            }
+
+#       else
+
+            _file = nullptr;
+
+#       endif
+
+        }
+
+        perf_map(const perf_map &) = delete;
+        perf_map &operator=(const perf_map &) = delete;
+
+        ~perf_map()
+        {
+
+#       ifdef __linux__
+
+            if (_marker) munmap(_marker, sysconf(_SC_PAGESIZE));
+            if (_format == jitdump)
+            {
+                // JIT_CODE_CLOSE
+                struct { std::uint32_t _id, _size; std::uint64_t _timestamp; } close { 3, 16, timestamp() };
+                std::fwrite(&close, sizeof close, 1, _file);
+            }
+            std::fclose(_file);
+
+#       endif
+
+        }
+
+        // Adds the function of size bytes at code, named codegen_<n> if the name is empty. It can
+        // be called on any thread.
+        void add(const std::string &name, const void *code, std::size_t size)
+        {
+
+#       ifdef __linux__
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto index = _index++;
+            std::string n = name.empty()? "codegen_" + std::to_string(index) : name;
+            if (_format == map) std::fprintf(_file, "%llx %zx %s\n", (unsigned long long)(std::uintptr_t)code, size, n.c_str());
+            else
+            {
+                auto addr = (std::uint64_t)(std::uintptr_t)code;
+                jitdump_load r { 0, (std::uint32_t)(sizeof(jitdump_load) + n.size() + 1 + size), timestamp(),
+                    (std::uint32_t)getpid(), (std::uint32_t)syscall(SYS_gettid), addr, addr, size, index };
+                std::fwrite(&r, sizeof r, 1, _file);
+                std::fwrite(n.c_str(), n.size() + 1, 1, _file);
+                std::fwrite(code, size, 1, _file);
+            }
+            std::fflush(_file);
+
+#       endif
+
+        }
+    };
+}
+
+#endif
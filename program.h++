@@ -31,6 +31,7 @@
 
 // TODO: Windows support
 
+#include <atomic>
 #include <vector>
 #include <functional>
 
@@ -43,14 +44,25 @@
 
 namespace codegen
 {
-    // TODO: facilitate data as a part of this (badly named) entity, as there is otherwise no
-    // portable way to guarantee that code and data are close enough to each other for shorter
-    // relative immediate offsets
+    // A program is the memory of a linked module, text, data, and bss, kept alive by reference
+    // counting in the function objects pointing to it. The constructor below maps pages of its
+    // own for each program, which is wasteful for small functions; arena (arena.h++) packs many
+    // programs in shared pages, instead, and also keeps code and data close enough to each other
+    // for shorter relative immediate offsets. The reference count is atomic, so that the function
+    // objects can be copied and destroyed on any thread.
     class program
     {
+    protected:
+
         byte *_pages = nullptr;
         std::size_t _text_size, _size = 0;
-        unsigned _refs = 1;
+        std::size_t _text_bytes = 0; // of machine code, without the padding to pages
+        std::atomic<unsigned> _refs { 1 };
+
+        // for programs whose memory is managed by someone else
+        program() { }
+
+    public:
 
         static std::size_t page_size()
         {
@@ -63,8 +75,6 @@ namespace codegen
             return (p + a - 1) & (~(std::size_t)0 - a + 1);
         }
 
-    public:
-
         struct exception
         {
         };
@@ -73,6 +83,7 @@ namespace codegen
             const std::function<void(byte *, byte *, byte *)> &reloc = [](byte *, byte *, byte *) {})
         {
             if (text.empty() && data.empty() && !bss_size) return;
+            _text_bytes = text.size();
             _text_size = align(text.size());
             std::size_t bss_index = _text_size + align(data.size(), 64); // TODO: non-hard-coded cache line alignment
             _size = align(bss_index + bss_size);
@@ -102,7 +113,7 @@ namespace codegen
 
 #       ifdef CODEGEN_USE_MMAP
 
-            if (_pages) munmap(_pages, _size);
+            if (_pages && _size) munmap(_pages, _size);
 
 #       endif
 
@@ -113,14 +124,20 @@ namespace codegen
             return _pages;
         }
 
+        // The bytes of machine code at the start of the program
+        std::size_t text_bytes() const
+        {
+            return _text_bytes;
+        }
+
         void add_ref()
         {
-            ++_refs;
+            _refs.fetch_add(1, std::memory_order_relaxed);
         }
 
         void remove_ref()
         {
-            if (--_refs) delete this;
+            if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
         }
     };
 }
@@ -19,7 +19,11 @@
 #ifndef CODEGEN_RA
 #define CODEGEN_RA
 
+#include <algorithm>
+#include <queue>
+
 #include "remapper.h++"
+#include "semantics.h++"
 
 namespace codegen
 {
@@ -60,6 +64,7 @@ namespace codegen
                     c._reg[k++] = _regs[var];
                 }
             }
+            return c;
         }
 
         void add(ir::word var, ir::word reg)
@@ -578,6 +583,754 @@ namespace codegen
             code.pass(gen);
         }
     };
+
+    struct out_of_registers
+    {
+    };
+
+    // A linear scan register allocator. Where ra above follows the structure of the code with maps
+    // from variables to registers, this one numbers the variables densely, computes their liveness
+    // as bitsets over basic blocks, makes one live interval of each, and assigns the registers in a
+    // single pass over the intervals, so that the time taken is roughly linear in the size of the
+    // code. All of its state is in vectors indexed by node numbers, variables or registers.
+    //
+    // A variable that does not get a register for its whole interval is spilled everywhere: it lives
+    // in a stack slot of the function (an extra argument of Enter), is loaded right before every
+    // statement reading it and stored right after every statement writing it. The registers for the
+    // loads and stores are allocated as tiny intervals of their own. Callee saved registers are
+    // variables live from Enter to Exit, so they are saved and restored by spilling them, which
+    // happens only when the function actually needs more registers than the others.
+    //
+    // REGS describes the registers by index: count, is_allocatable, is_callee_saved, index (of a
+    // key, or -1 for a group), accepts (whether a key can be in an index), key (of an index in a
+    // group), full_key, group (of a type), and slot_words (the stack slot size of a type).
+    template<class REGS> class linear_ra
+    {
+        enum : std::uint8_t { reads_first = 1, reads = 2, writes = 4 };
+
+        struct occurrence
+        {
+            std::uint32_t _point; // node number of the statement
+            std::uint32_t _var;
+            ir::word _node; // node number of the Reg, or -1
+            ir::word _key;
+            std::uint8_t _mode;
+            std::int8_t _reg; // where a spilled variable is loaded to or stored from
+        };
+
+        struct variable
+        {
+            ir::word _node; // node number, or -1 for a callee saved register
+            std::uint32_t _start, _end;
+            std::uint8_t _start_mode, _end_mode;
+            std::uint32_t _fun;
+            std::int32_t _block; // the only block the variable occurs in, or -1
+            std::int32_t _first = -1, _last; // occurrences, in _var_occ
+            std::int32_t _coalesce = -1; // variable whose register this one may take over at _start
+            std::int32_t _slot = -1;
+            std::int8_t _fixed = -1, _hint = -1, _reg = -1;
+            std::uint8_t _words = 1; // size of the stack slot
+            bool _spillable;
+        };
+
+        struct block
+        {
+            std::uint32_t _first, _last;
+            std::uint32_t _occ; // first occurrence
+            ir::word _target = -1; // node number of the label, Skip, SkipIf or Forever jumped to
+            bool _falls = true;
+        };
+
+        struct demand
+        {
+            std::uint32_t _point, _var;
+            std::uint8_t _mode;
+        };
+
+        struct holder
+        {
+            std::int32_t _var = -1;
+            std::uint32_t _end;
+            std::uint8_t _end_mode;
+            bool _window;
+        };
+
+        struct window
+        {
+            std::uint32_t _point, _var;
+            std::int32_t _first; // in _var_occ
+
+            bool operator<(const window &w) const
+            {
+                return _point > w._point;
+            }
+        };
+
+        // A Move from a register to a variable, or of an operation whose first operand is one
+        struct copy
+        {
+            std::uint32_t _point, _dst, _src;
+        };
+
+        struct function
+        {
+            std::uint32_t _enter;
+            std::vector<std::uint8_t> _slots; // sizes of the stack slots in words
+            std::int32_t _saved; // first of the callee saved register variables
+        };
+
+        std::vector<occurrence> _occ;
+        std::vector<std::int32_t> _var_occ;
+        std::vector<variable> _vars;
+        std::vector<block> _blocks;
+        std::vector<function> _funs;
+        std::vector<copy> _copies;
+        std::vector<std::vector<demand>> _demands;
+
+        std::vector<std::int32_t> _var_of; // by node number
+        std::vector<std::int32_t> _occ_of; // first occurrence, by node number of Reg
+        std::vector<std::int32_t> _block_of; // by node number of a jump target
+        std::vector<ir::word> _newpos; // by node number
+        std::vector<ir::word> _saved; // Temps of the callee saved registers of the current function
+
+        holder _holders[REGS::count];
+        std::priority_queue<window> _windows;
+
+        std::size_t _loads = 0, _stores = 0; // of spilled variables
+
+        static bool shares(std::uint8_t ending, std::uint8_t starting)
+        {
+            // The first operand can be the destination of a two-address instruction
+            return ending == reads_first && starting == writes;
+        }
+
+        std::int32_t var(const ir::code &code, ir::word n)
+        {
+            auto &nodes = code.nodes();
+            if (_var_of[n] < 0)
+            {
+                _var_of[n] = _vars.size();
+                _vars.emplace_back();
+                _vars.back()._node = n;
+                _vars.back()._spillable = nodes.id(n) == ir::node_id::Temp;
+                _vars.back()._fun = _funs.size() - 1;
+                if (_vars.back()._spillable) _vars.back()._words = REGS::slot_words(semantics(code, nodes.pos(n)).type());
+            }
+            return _var_of[n];
+        }
+
+        void occur(std::uint32_t point, std::int32_t v, ir::word key, std::uint8_t mode, ir::word node = -1)
+        {
+            _occ.push_back({ point, (std::uint32_t)v, node, key, mode, -1 });
+            auto &x = _vars[v];
+            std::int32_t b = _blocks.size() - 1;
+            if (x._first < 0)
+            {
+                x._first = 0;
+                x._block = b;
+            }
+            else if (x._block != b) x._block = -1;
+            if (x._fixed < 0) x._fixed = REGS::index(key);
+        }
+
+        static bool is_statement(ir::word id)
+        {
+            return !ir::node_index::is_pure(id) && id != ir::node_id::Mem;
+        }
+
+        static std::int32_t saved()
+        {
+            std::int32_t k = 0;
+            for (unsigned r = 0; r < REGS::count; ++r) k += REGS::is_allocatable(r) && REGS::is_callee_saved(r);
+            return k;
+        }
+
+        void scan(const ir::code &code)
+        {
+            auto &nodes = code.nodes();
+            std::vector<ir::word> regs, stack;
+            bool ended = true;
+            for (ir::word n = 0; n < nodes.count(); ++n)
+            {
+                ir::word id = nodes.id(n);
+                const ir::word *args = nodes.arguments(n);
+                if (!is_statement(id)) continue;
+
+                if (ended || id == ir::node_id::Mark || id == ir::node_id::Here || id == ir::node_id::Forever || id == ir::node_id::Enter)
+                {
+                    if (!ended) _blocks.back()._last = n - 1;
+                    _blocks.push_back({ (std::uint32_t)n, (std::uint32_t)n, (std::uint32_t)_occ.size() });
+                    ended = false;
+                }
+                _blocks.back()._last = n;
+
+                switch (id)
+                {
+                    case ir::node_id::Enter:
+                        _funs.push_back({ (std::uint32_t)n, { }, 0 });
+                        _funs.back()._saved = _vars.size();
+                        for (unsigned r = 0; r < REGS::count; ++r) if (REGS::is_allocatable(r) && REGS::is_callee_saved(r))
+                        {
+                            _vars.emplace_back();
+                            _vars.back()._node = -1;
+                            _vars.back()._spillable = true;
+                            _vars.back()._fun = _funs.size() - 1;
+                            occur(n, _vars.size() - 1, REGS::full_key(r), writes);
+                        }
+                        break;
+                    case ir::node_id::Mark:
+                        _block_of[nodes.number(args[0])] = _blocks.size() - 1;
+                        break;
+                    case ir::node_id::Here:
+                        _block_of[nodes.number(args[0])] = _blocks.size() - 1;
+                        break;
+                    case ir::node_id::Forever:
+                        _block_of[n] = _blocks.size() - 1;
+                        break;
+                }
+
+                // The Regs a statement uses are in its expression trees. The first operand is told
+                // apart from the others, because its register can be reused for the destination.
+                regs.clear();
+                for (ir::word i = 0; i < nodes.nargs(n); ++i)
+                    if (ir::node_index::is_id(id, i) && args[i] >= 0 && args[i] < nodes.pos(n)) stack.push_back(nodes.number(args[i]));
+                while (!stack.empty())
+                {
+                    ir::word e = stack.back(), eid = nodes.id(e);
+                    stack.pop_back();
+                    if (eid == ir::node_id::Reg) regs.push_back(e);
+                    else if (eid != ir::node_id::Temp && !is_statement(eid))
+                        for (ir::word i = 0; i < nodes.nargs(e); ++i)
+                            if (ir::node_index::is_id(eid, i) && nodes.arguments(e)[i] >= 0) stack.push_back(nodes.number(nodes.arguments(e)[i]));
+                }
+
+                ir::word dst = -1, first = -1;
+                if (ir::node_index::is_write(id))
+                {
+                    dst = nodes.number(args[0]);
+                    if (nodes.id(dst) == ir::node_id::Temp)
+                    {
+                        auto v = var(code, dst);
+                        occur(n, v, REGS::group(semantics(code, nodes.pos(dst)).type()), writes);
+                    }
+                }
+                if (id == ir::node_id::Move)
+                {
+                    first = nodes.number(args[1]);
+                    if (nodes.id(first) != ir::node_id::Reg)
+                        first = semantics(code, args[1]).is<ir::arithmetic>()? nodes.number(nodes.arguments(first)[0]) : -1;
+                }
+                for (auto r : regs)
+                {
+                    auto v = var(code, nodes.number(nodes.arguments(r)[0]));
+                    if (_occ_of[r] < 0) _occ_of[r] = _occ.size();
+                    occur(n, v, nodes.arguments(r)[1], r == dst? writes : r == first? reads_first : reads, r);
+                }
+                if (dst >= 0 && first >= 0 && nodes.id(first) == ir::node_id::Reg)
+                {
+                    ir::word d = nodes.id(dst) == ir::node_id::Reg? nodes.number(nodes.arguments(dst)[0]) : dst;
+                    if (_var_of[d] >= 0) _copies.push_back({ (std::uint32_t)n, (std::uint32_t)_var_of[d], _occ[_occ_of[first]]._var });
+                }
+
+                switch (id)
+                {
+                    case ir::node_id::Exit:
+                        for (std::int32_t v = _funs.back()._saved; v < _funs.back()._saved + saved(); ++v)
+                            occur(n, v, REGS::full_key(_vars[v]._fixed), reads);
+                        _blocks.back()._falls = false;
+                        ended = true;
+                        break;
+                    case ir::node_id::Jump:
+                        _blocks.back()._falls = false;
+                        _blocks.back()._target = nodes.number(args[0]);
+                        ended = true;
+                        break;
+                    case ir::node_id::Branch:
+                        _blocks.back()._target = nodes.number(args[0]);
+                        ended = true;
+                        break;
+                    case ir::node_id::Skip:
+                        _blocks.back()._falls = false;
+                        _blocks.back()._target = n;
+                        ended = true;
+                        break;
+                    case ir::node_id::SkipIf:
+                        _blocks.back()._target = n;
+                        ended = true;
+                        break;
+                    case ir::node_id::Repeat:
+                        _blocks.back()._falls = false;
+                        _blocks.back()._target = nodes.number(args[0]);
+                        ended = true;
+                        break;
+                }
+            }
+        }
+
+        // Lists the occurrences of each variable in order, and makes the live intervals. An interval
+        // covers the occurrences of the variable and the blocks it is live into or out of.
+        void analyze()
+        {
+            std::vector<std::int32_t> next(_vars.size() + 1, 0);
+            for (auto &o : _occ) ++next[o._var + 1];
+            for (std::size_t v = 0; v < _vars.size(); ++v)
+            {
+                next[v + 1] += next[v];
+                _vars[v]._first = next[v];
+                _vars[v]._last = next[v + 1];
+            }
+            _var_occ.resize(_occ.size());
+            for (std::size_t i = 0; i < _occ.size(); ++i) _var_occ[next[_occ[i]._var]++] = i;
+
+            for (auto &x : _vars)
+            {
+                x._start = _occ[_var_occ[x._first]]._point;
+                x._end = _occ[_var_occ[x._last - 1]]._point;
+                x._start_mode = x._end_mode = 0;
+                for (auto i = x._first; i < x._last && _occ[_var_occ[i]]._point == x._start; ++i) x._start_mode |= _occ[_var_occ[i]]._mode;
+                for (auto i = x._last; i > x._first && _occ[_var_occ[i - 1]]._point == x._end; --i) x._end_mode |= _occ[_var_occ[i - 1]]._mode;
+                x._hint = x._fixed;
+            }
+
+            // Only the variables that occur in more than one block need liveness
+            std::vector<std::int32_t> global, index(_vars.size(), -1);
+            for (std::size_t v = 0; v < _vars.size(); ++v) if (_vars[v]._block < 0)
+            {
+                index[v] = global.size();
+                global.push_back(v);
+            }
+            std::size_t w = (global.size() + 63) / 64, nb = _blocks.size();
+            std::vector<std::uint64_t> use(nb * w), def(nb * w), in(nb * w), out(nb * w);
+            for (std::size_t b = 0; b < nb; ++b)
+            {
+                std::size_t end = b + 1 < nb? _blocks[b + 1]._occ : _occ.size();
+                for (std::size_t i = _blocks[b]._occ, j; i < end; i = j)
+                {
+                    // Reads happen before writes within a statement
+                    for (j = i; j < end && _occ[j]._point == _occ[i]._point; ++j)
+                    {
+                        auto g = index[_occ[j]._var];
+                        if (g >= 0 && _occ[j]._mode != writes && !(def[b * w + g / 64] >> g % 64 & 1)) use[b * w + g / 64] |= std::uint64_t(1) << g % 64;
+                    }
+                    for (auto k = i; k < j; ++k)
+                    {
+                        auto g = index[_occ[k]._var];
+                        if (g >= 0 && _occ[k]._mode == writes) def[b * w + g / 64] |= std::uint64_t(1) << g % 64;
+                    }
+                }
+            }
+
+            for (bool changed = w > 0; changed; )
+            {
+                changed = false;
+                for (std::size_t b = nb; b--; )
+                {
+                    std::int32_t t = _blocks[b]._target >= 0? _block_of[_blocks[b]._target] : -1;
+                    bool falls = _blocks[b]._falls && b + 1 < nb;
+                    for (std::size_t k = 0; k < w; ++k)
+                    {
+                        std::uint64_t o = (falls? in[(b + 1) * w + k] : 0) | (t >= 0? in[t * w + k] : 0);
+                        std::uint64_t i = use[b * w + k] | (o & ~def[b * w + k]);
+                        out[b * w + k] = o;
+                        if (i != in[b * w + k])
+                        {
+                            in[b * w + k] = i;
+                            changed = true;
+                        }
+                    }
+                }
+            }
+
+            for (std::size_t b = 0; b < nb; ++b)
+                for (std::size_t k = 0; k < w; ++k)
+                {
+                    for (auto bits = in[b * w + k]; bits; bits &= bits - 1)
+                    {
+                        auto &x = _vars[global[k * 64 + __builtin_ctzll(bits)]];
+                        if (_blocks[b]._first <= x._start)
+                        {
+                            x._start = _blocks[b]._first;
+                            x._start_mode = reads;
+                        }
+                    }
+                    for (auto bits = out[b * w + k]; bits; bits &= bits - 1)
+                    {
+                        auto &x = _vars[global[k * 64 + __builtin_ctzll(bits)]];
+                        if (_blocks[b]._last >= x._end)
+                        {
+                            x._end = _blocks[b]._last;
+                            x._end_mode = reads;
+                        }
+                    }
+                }
+
+            // A variable copied to another one where its interval ends would like to be in the
+            // register the other one would like to be in, and the other one can take it over.
+            for (auto c = _copies.rbegin(); c != _copies.rend(); ++c)
+            {
+                auto &d = _vars[c->_dst], &src = _vars[c->_src];
+                if (src._end != c->_point || src._end_mode != reads_first) continue;
+                if (src._hint < 0) src._hint = d._hint;
+                if (d._start == c->_point && d._start_mode == writes) d._coalesce = c->_src;
+            }
+        }
+
+        bool is_free(std::int32_t r, std::uint32_t start, std::uint8_t mode) const
+        {
+            auto &h = _holders[r];
+            return h._var < 0 || h._end < start || (h._end == start && shares(h._end_mode, mode));
+        }
+
+        // Whether some other variable must be in register r somewhere in the interval
+        bool conflicts(std::int32_t r, std::uint32_t v, std::uint32_t start, std::uint32_t end, std::uint8_t start_mode, std::uint8_t end_mode) const
+        {
+            auto &d = _demands[r];
+            auto i = std::lower_bound(d.begin(), d.end(), start, [](const demand &x, std::uint32_t p) { return x._point < p; });
+            for (; i != d.end() && i->_point <= end; ++i)
+            {
+                if (i->_var == v) continue;
+                if (i->_point == start && shares(i->_mode, start_mode)) continue;
+                if (i->_point == end && shares(end_mode, i->_mode)) continue;
+                return true;
+            }
+            return false;
+        }
+
+        bool fits(std::int32_t r, std::uint32_t v, std::uint32_t start, std::uint32_t end, std::uint8_t start_mode, std::uint8_t end_mode) const
+        {
+            return r >= 0 && REGS::is_allocatable(r) && REGS::accepts(_occ[_var_occ[_vars[v]._first]]._key, r) &&
+                is_free(r, start, start_mode) && !conflicts(r, v, start, end, start_mode, end_mode);
+        }
+
+        // The register of the spillable variable whose interval ends last, among the registers v
+        // could use, or -1
+        std::int32_t victim(std::uint32_t v, std::uint32_t start, std::uint32_t end, std::uint8_t start_mode, std::uint8_t end_mode, std::int32_t only = -1) const
+        {
+            std::int32_t victim = -1;
+            for (std::int32_t r = 0; r < (std::int32_t)REGS::count; ++r)
+            {
+                auto &h = _holders[r];
+                if (h._var < 0 || h._window || h._end < start || !_vars[h._var]._spillable || (only >= 0 && r != only)) continue;
+                if (!REGS::accepts(_occ[_var_occ[_vars[v]._first]]._key, r) || conflicts(r, v, start, end, start_mode, end_mode)) continue;
+                if (victim < 0 || h._end > _holders[victim]._end) victim = r;
+            }
+            return victim;
+        }
+
+        // Moves variable v to a stack slot from point p on. The occurrences before p keep using
+        // the register the variable had, the rest get windows.
+        void spill(std::uint32_t v, std::uint32_t p)
+        {
+            auto &x = _vars[v];
+            x._slot = _funs[x._fun]._slots.size();
+            _funs[x._fun]._slots.push_back(x._words);
+            for (auto i = x._first; i < x._last; ++i)
+            {
+                auto &o = _occ[_var_occ[i]];
+                if (o._point < p) o._reg = x._reg;
+                else if (i == x._first || _occ[_var_occ[i - 1]]._point != o._point) _windows.push({ o._point, v, i });
+            }
+            if (x._reg >= 0) _holders[x._reg]._var = -1;
+            x._reg = -1;
+        }
+
+        void assign(std::uint32_t v)
+        {
+            auto &x = _vars[v];
+            auto fits = [&](std::int32_t r) { return this->fits(r, v, x._start, x._end, x._start_mode, x._end_mode); };
+            std::int32_t r = -1;
+            if (fits(x._fixed)) r = x._fixed;
+            else if (fits(x._hint)) r = x._hint;
+            else if (x._coalesce >= 0 && fits(_vars[x._coalesce]._reg)) r = _vars[x._coalesce]._reg;
+            else for (std::int32_t i = 0; i < (std::int32_t)REGS::count && r < 0; ++i) if (fits(i)) r = i;
+            if (r < 0)
+            {
+                r = victim(v, x._start, x._end, x._start_mode, x._end_mode);
+                if (r >= 0 && (_holders[r]._end > x._end || !x._spillable)) spill(_holders[r]._var, x._start);
+                else if (x._spillable)
+                {
+                    spill(v, x._start);
+                    return;
+                }
+                else throw out_of_registers();
+            }
+            x._reg = r;
+            _holders[r] = { (std::int32_t)v, x._end, x._end_mode, false };
+        }
+
+        void place(const window &w)
+        {
+            auto &x = _vars[w._var];
+            std::uint8_t mode = 0;
+            std::int32_t fixed = -1, last = w._first;
+            for (; last < x._last && _occ[_var_occ[last]]._point == w._point; ++last)
+            {
+                mode |= _occ[_var_occ[last]]._mode;
+                if (fixed < 0) fixed = REGS::index(_occ[_var_occ[last]]._key);
+            }
+            std::int32_t r = fixed >= 0 && fits(fixed, w._var, w._point, w._point, mode, mode)? fixed : -1;
+            for (std::int32_t i = 0; fixed < 0 && i < (std::int32_t)REGS::count && r < 0; ++i)
+                if (fits(i, w._var, w._point, w._point, mode, mode)) r = i;
+            if (r < 0)
+            {
+                r = victim(w._var, w._point, w._point, mode, mode, fixed);
+                if (r < 0) throw out_of_registers();
+                spill(_holders[r]._var, w._point);
+            }
+            for (auto i = w._first; i < last; ++i) _occ[_var_occ[i]]._reg = r;
+            _holders[r] = { (std::int32_t)w._var, w._point, mode, true };
+        }
+
+        void allocate(std::size_t points)
+        {
+            _demands.resize(REGS::count);
+            for (auto &d : _demands) d.clear();
+            for (auto &o : _occ)
+            {
+                auto r = REGS::index(o._key);
+                if (r >= 0) _demands[r].push_back({ o._point, o._var, o._mode });
+            }
+
+            std::vector<std::uint32_t> order(_vars.size()), first(points + 1, 0);
+            for (auto &x : _vars) ++first[x._start + 1];
+            for (std::size_t p = 0; p < points; ++p) first[p + 1] += first[p];
+            for (std::size_t v = 0; v < _vars.size(); ++v) order[first[_vars[v]._start]++] = v;
+
+            for (std::size_t k = 0; k < order.size() || !_windows.empty(); )
+                if (!_windows.empty() && (k == order.size() || _windows.top()._point <= _vars[order[k]]._start))
+                {
+                    auto w = _windows.top();
+                    _windows.pop();
+                    place(w);
+                }
+                else assign(order[k++]);
+        }
+
+        template<class OUT> struct copier
+        {
+            linear_ra &_ra;
+            OUT &_out;
+            ir::word _dst;
+            const ir::word *_args; // new positions of the arguments, if not the usual ones
+            ir::word _pos;
+
+            copier(linear_ra &ra, OUT &out, ir::word dst = -1, const ir::word *args = nullptr) : _ra(ra), _out(out), _dst(dst), _args(args) { }
+
+            template<class NODE> void operator()(const ir::code &code, ir::word pos, const NODE &node)
+            {
+                auto &nodes = code.nodes();
+                NODE onode = node;
+                for (unsigned i = 0; i < node.nargs(); ++i)
+                    if (node.is_id(i) && node[i] >= 0 && node[i] < pos) onode[i] = _args? _args[i] : _ra._newpos[nodes.number(node[i])];
+                if (_dst >= 0) onode[0] = _dst;
+                _pos = _out(onode);
+            }
+        };
+
+        // The register of the variable at the occurrence
+        std::int32_t reg(const occurrence &o) const
+        {
+            auto r = REGS::index(o._key);
+            if (r >= 0) return r;
+            return _vars[o._var]._slot >= 0? o._reg : _vars[o._var]._reg;
+        }
+
+        ir::word key(const occurrence &o) const
+        {
+            return REGS::index(o._key) >= 0? o._key : REGS::key(o._key, reg(o));
+        }
+
+        // The key of register r as wide as variable v is, for moving the variable between registers
+        ir::word move_key(std::uint32_t v, std::int32_t r) const
+        {
+            return REGS::key(_occ[_var_occ[_vars[v]._first]]._key, r);
+        }
+
+        ir::word node_of(std::uint32_t v) const
+        {
+            auto &x = _vars[v];
+            return x._node >= 0? _newpos[x._node] : _saved[v - _funs[x._fun]._saved];
+        }
+
+        // The new position of expression e as the occurrences from begin to end see it. The Regs
+        // are emitted with the keys of their first occurrences, so where an expression is shared by
+        // statements and a spilled variable is loaded to different registers for them, the later
+        // statements get copies of the expression.
+        template<class OUT> ir::word rewrite(OUT &out, const ir::code &code, ir::word e, std::size_t begin, std::size_t end)
+        {
+            auto &nodes = code.nodes();
+            ir::word id = nodes.id(e);
+            if (id == ir::node_id::Reg)
+            {
+                for (auto i = begin; i < end; ++i) if (_occ[i]._node == e)
+                {
+                    if (key(_occ[i]) == key(_occ[_occ_of[e]])) break;
+                    return out(ir::Reg(node_of(_occ[i]._var), key(_occ[i])));
+                }
+                return _newpos[e];
+            }
+            if (id == ir::node_id::Temp || is_statement(id)) return _newpos[e];
+
+            const ir::word *args = nodes.arguments(e);
+            std::vector<ir::word> nargs(args, args + nodes.nargs(e));
+            bool changed = false;
+            for (std::size_t i = 0; i < nargs.size(); ++i) if (ir::node_index::is_id(id, i) && args[i] >= 0)
+            {
+                nargs[i] = rewrite(out, code, nodes.number(args[i]), begin, end);
+                changed |= nargs[i] != _newpos[nodes.number(args[i])];
+            }
+            if (!changed) return _newpos[e];
+            copier<OUT> c(*this, out, -1, nargs.data());
+            code.pass_at(c, nodes.pos(e));
+            return c._pos;
+        }
+
+        template<class OUT> void emit(OUT &out, const ir::code &code)
+        {
+            auto &nodes = code.nodes();
+            _newpos.assign(nodes.count(), 0);
+            _saved.assign(linear_ra::saved(), -1);
+            std::vector<std::pair<std::uint32_t, std::int32_t>> moved;
+
+            for (std::size_t n = 0, k = 0, f = 0; n < (std::size_t)nodes.count(); ++n)
+            {
+                ir::word id = nodes.id(n);
+                if (id == ir::node_id::Reg && _occ_of[n] >= 0)
+                {
+                    auto &o = _occ[_occ_of[n]];
+                    _newpos[n] = out(ir::Reg(node_of(o._var), key(o)));
+                    continue;
+                }
+                if (!is_statement(id))
+                {
+                    copier<OUT> c(*this, out);
+                    code.pass_at(c, nodes.pos(n));
+                    _newpos[n] = c._pos;
+                    continue;
+                }
+
+                std::size_t begin = k;
+                while (k < _occ.size() && _occ[k]._point == n) ++k;
+
+                // Loads of spilled variables and moves to the registers the statement wants them in
+                moved.clear();
+                for (auto i = begin; i < k; ++i)
+                {
+                    auto &o = _occ[i];
+                    auto &x = _vars[o._var];
+                    auto r = reg(o);
+                    if (o._mode == writes || std::find(moved.begin(), moved.end(), std::make_pair(o._var, r)) != moved.end()) continue;
+                    moved.emplace_back(o._var, r);
+                    if (x._slot >= 0)
+                    {
+                        out(ir::Move(out(ir::Reg(node_of(o._var), REGS::full_key(r))), node_of(o._var)));
+                        ++_loads;
+                    }
+                    else if (r != x._reg) out(ir::RMove(move_key(o._var, r), move_key(o._var, x._reg)));
+                }
+
+                if (id == ir::node_id::Enter)
+                {
+                    auto &fun = _funs[f++];
+                    std::vector<ir::word> args(nodes.arguments(n), nodes.arguments(n) + nodes.nargs(n));
+                    for (auto &a : args) a = _newpos[nodes.number(a)];
+                    // Slots of more than a word are arrays of words
+                    ir::word type = fun._slots.empty()? -1 : out(ir::Int(-64));
+                    std::vector<ir::word> types = { -1, type };
+                    for (auto w : fun._slots)
+                    {
+                        if (w >= types.size()) types.resize(w + 1, -1);
+                        if (types[w] < 0) types[w] = out(ir::Array(type, w));
+                        args.push_back(types[w]);
+                    }
+                    _newpos[n] = out(ir::Enter((const ir::word *)args.data(), (ir::word)args.size()));
+                    // The callee saved registers of the previous function are not those of this one
+                    _saved.assign(linear_ra::saved(), -1);
+                    for (std::int32_t i = 0; i < linear_ra::saved(); ++i)
+                        if (_vars[fun._saved + i]._slot >= 0) _saved[i] = out(ir::Temp(type));
+                }
+                else
+                {
+                    // A variable written to directly gets a register here
+                    ir::word dst = -1;
+                    if (ir::node_index::is_write(id))
+                        for (auto i = begin; i < k; ++i)
+                            if (_vars[_occ[i]._var]._node == nodes.number(nodes.arguments(n)[0]))
+                            {
+                                dst = out(ir::Reg(node_of(_occ[i]._var), key(_occ[i])));
+                                break;
+                            }
+                    bool shared = false;
+                    for (auto i = begin; i < k; ++i)
+                        if (_occ[i]._node >= 0 && _occ_of[_occ[i]._node] != (std::int32_t)i && key(_occ[i]) != key(_occ[_occ_of[_occ[i]._node]])) shared = true;
+                    std::vector<ir::word> args;
+                    if (shared)
+                    {
+                        args.assign(nodes.arguments(n), nodes.arguments(n) + nodes.nargs(n));
+                        for (std::size_t i = 0; i < args.size(); ++i) if (ir::node_index::is_id(id, i) && args[i] >= 0 && args[i] < nodes.pos(n))
+                            args[i] = rewrite(out, code, nodes.number(args[i]), begin, k);
+                    }
+                    copier<OUT> c(*this, out, dst, shared? args.data() : nullptr);
+                    code.pass_at(c, nodes.pos(n));
+                    _newpos[n] = c._pos;
+                }
+
+                // Stores of spilled variables and moves from the registers the statement wrote to
+                for (auto i = begin; i < k; ++i)
+                {
+                    auto &o = _occ[i];
+                    auto &x = _vars[o._var];
+                    auto r = reg(o);
+                    if (o._mode != writes) continue;
+                    if (x._slot >= 0)
+                    {
+                        out(ir::Move(node_of(o._var), out(ir::Reg(node_of(o._var), REGS::full_key(r)))));
+                        ++_stores;
+                    }
+                    else if (r != x._reg) out(ir::RMove(move_key(o._var, x._reg), move_key(o._var, r)));
+                }
+            }
+        }
+
+    public:
+
+        struct statistics
+        {
+            std::size_t _variables, _spilled, _slot_words, _loads, _stores;
+        };
+
+        // What the last process did. The variables include the callee saved registers, which are
+        // spilled when they are saved.
+        statistics stats() const
+        {
+            statistics s { _vars.size(), 0, 0, _loads, _stores };
+            for (auto &x : _vars) if (x._slot >= 0) ++s._spilled;
+            for (auto &f : _funs) for (auto w : f._slots) s._slot_words += w;
+            return s;
+        }
+
+        // An allocator can be used for any number of functions, one after another, and it keeps
+        // its memory from one to the next.
+        template<class OUT> void process(OUT &out, const ir::code &code)
+        {
+            auto &nodes = code.nodes();
+            _occ.clear();
+            _vars.clear();
+            _blocks.clear();
+            _funs.clear();
+            _copies.clear();
+            _saved.clear();
+            _loads = _stores = 0;
+            for (auto &h : _holders) h = holder();
+            _var_of.assign(nodes.count(), -1);
+            _occ_of.assign(nodes.count(), -1);
+            _block_of.assign(nodes.count(), -1);
+            scan(code);
+            analyze();
+            allocate(nodes.count());
+            emit(out, code);
+        }
+    };
 }
 
 #endif
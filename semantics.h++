@@ -40,61 +40,6 @@ namespace codegen
             }
         };
 
-        struct type_query
-        {
-            using rval = ir::word;
-
-            rval operator()(const ir::code &code, ir::word pos, const ir::node &node) const
-            {
-                return -1;
-            }
-
-            rval operator()(const ir::code &code, ir::word pos, const ir::arithmetic &node) const
-            {
-                return semantics(code, semantics(code, pos)[0]).type().pos();
-            }
-
-            rval operator()(const ir::code &code, ir::word pos, const ir::compare &node) const
-            {
-                return pos;
-            }
-
-            rval operator()(const ir::code &code, ir::word pos, const ir::Reg &node) const
-            {
-                return semantics(code, node[0]).type().pos();
-            }
-
-            rval operator()(const ir::code &code, ir::word pos, const ir::Temp &node) const
-            {
-                return node[0];
-            }
-
-            rval operator()(const ir::code &code, ir::word pos, const ir::RVal &node) const
-            {
-                return semantics(code, node[0]).type()[1];
-            }
-
-            rval operator()(const ir::code &code, ir::word pos, const ir::Arg &node) const
-            {
-                return semantics(code, node[0]).type()[2 + node[1]];
-            }
-
-            rval operator()(const ir::code &code, ir::word pos, const ir::Enter &node) const
-            {
-                return node[0];
-            }
-
-            rval operator()(const ir::code &code, ir::word pos, const ir::Conv &node) const
-            {
-                return node[0];
-            }
-
-            rval operator()(const ir::code &code, ir::word pos, const ir::Cast &node) const
-            {
-                return node[0];
-            }
-        };
-
         struct is_signed_query
         {
             using rval = bool;
@@ -125,6 +70,11 @@ namespace codegen
             if (pos < 0) throw 0; // TODO: an actual exception
         }
 
+        const ir::code &code() const
+        {
+            return _code;
+        }
+
         ir::word pos() const
         {
             return _pos;
@@ -142,7 +92,8 @@ namespace codegen
 
         semantics type() const
         {
-            return semantics(_code, _code.query_at(type_query(), _pos));
+            auto &nodes = _code.nodes();
+            return semantics(_code, nodes.type(nodes.number(_pos)));
         }
 
         bool is_signed() const
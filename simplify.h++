@@ -342,7 +342,7 @@ namespace codegen
                 if (!_rev->_used[pos]) return;
                 (*_out)(pos, node);
                 auto ci = _constants._int_constants.find(node[1]);
-                if (ci != _constants._int_constants.end()) _constants._int_constants[pos] = ci->second;
+                if (ci != _constants._int_constants.end() && semantics(code, node[0]).is<ir::Int>()) _constants._int_constants[pos] = ci->second;
             }
 
             void operator()(const ir::code &code, ir::word pos, const ir::Conv &node)
@@ -350,7 +350,7 @@ namespace codegen
                 if (!_rev->_used[pos]) return;
                 (*_out)(pos, node);
                 auto ci = _constants._int_constants.find(node[1]);
-                if (ci != _constants._int_constants.end()) _constants._int_constants[pos] = ci->second;
+                if (ci != _constants._int_constants.end() && semantics(code, node[0]).is<ir::Int>()) _constants._int_constants[pos] = ci->second;
             }
 
             void operator()(const ir::code &code, ir::word pos, const ir::Not &node)
@@ -466,6 +466,428 @@ namespace codegen
                 _subexpr.clear();
             }
         };
+
+        // Value numbering over whole functions, instead of the basic blocks of fwd_pass. A pure node
+        // shared by several statements is computed at its first use, and that value is used by
+        // the rest of them. So a node can stand for an equal one if its first use dominates the
+        // statement, and none of the Temps it depends on has been written since. In structured
+        // code, a use stops dominating at the Here or Repeat closing its region, and a value
+        // depending on Temps is not carried into a loop, where the Temps may change on each round.
+        struct value_numbering
+        {
+            struct value
+            {
+                std::set<ir::word> _deps;
+                ir::word _use;
+            };
+
+            remapper<ir::code> &_out;
+            std::map<fwd_pass::key, ir::word> _values;
+            std::map<ir::word, value> _info;
+            std::map<ir::word, ir::word> _canon;
+
+            value_numbering(remapper<ir::code> &out) : _out(out) { }
+
+            ir::word canon(ir::word pos)
+            {
+                auto ci = _canon.find(pos);
+                return ci == _canon.end()? pos : ci->second;
+            }
+
+            void collect(const ir::code &code, ir::word pos, std::set<ir::word> &deps)
+            {
+                auto &nodes = code.nodes();
+                ir::word n = nodes.number(pos), id = nodes.id(n);
+                auto ii = _info.find(canon(pos));
+                if (ii != _info.end()) deps.insert(ii->second._deps.begin(), ii->second._deps.end());
+                else if (id == ir::node_id::Temp) deps.insert(pos);
+                else for (ir::word i = 0; i < nodes.nargs(n); ++i)
+                    if (ir::node_index::is_id(id, i) && nodes.arguments(n)[i] >= 0 && nodes.arguments(n)[i] < pos) collect(code, nodes.arguments(n)[i], deps);
+            }
+
+            void use(const ir::code &code, ir::word pos, ir::word stmt)
+            {
+                auto &nodes = code.nodes();
+                ir::word n = nodes.number(pos), id = nodes.id(n);
+                if (!ir::node_index::is_pure(id)) return;
+                auto ii = _info.find(canon(pos));
+                if (ii != _info.end())
+                {
+                    if (ii->second._use >= 0) return;
+                    ii->second._use = stmt;
+                }
+                for (ir::word i = 0; i < nodes.nargs(n); ++i)
+                    if (ir::node_index::is_id(id, i) && nodes.arguments(n)[i] >= 0 && nodes.arguments(n)[i] < pos) use(code, nodes.arguments(n)[i], stmt);
+            }
+
+            // Forgets the values that have been used, and match the predicate
+            template<class F> void forget(const F &f)
+            {
+                for (auto vi = _values.begin(); vi != _values.end(); )
+                {
+                    auto &v = _info[vi->second];
+                    if (v._use >= 0 && f(v)) vi = _values.erase(vi);
+                    else ++vi;
+                }
+            }
+
+            template<class NODE> void number(const ir::code &code, ir::word pos, const fwd_pass::key &k, const NODE &node)
+            {
+                auto vi = _values.find(k);
+                if (vi != _values.end() && _info[vi->second]._use >= 0)
+                {
+                    _out.map(vi->second, pos);
+                    _canon[pos] = vi->second;
+                    return;
+                }
+                value v{ {}, -1 };
+                for (unsigned i = 0; i < node.nargs(); ++i) if (node.is_id(i) && node[i] >= 0) collect(code, node[i], v._deps);
+                _out(pos, node);
+                _values[k] = pos;
+                _info[pos] = v;
+            }
+
+            template<class NODE> void statement(const ir::code &code, ir::word pos, const NODE &node)
+            {
+                for (unsigned i = 0; i < node.nargs(); ++i) if (node.is_id(i) && node[i] >= 0 && node[i] < pos) use(code, node[i], pos);
+                _out(pos, node);
+                if (semantics(code, pos).is<ir::wrnode>() && semantics(code, node[0]).is<ir::Temp>())
+                    forget([&](const value &v) { return v._deps.count(node[0]) != 0; });
+                switch (node.id())
+                {
+                    case ir::node_id::Here:
+                    case ir::node_id::Repeat:
+                        forget([&](const value &v) { return v._use > node[0]; });
+                        break;
+                    case ir::node_id::Forever:
+                        forget([&](const value &v) { return !v._deps.empty(); });
+                        break;
+                    case ir::node_id::Enter:
+                    case ir::node_id::Exit:
+                        _values.clear();
+                        _info.clear();
+                        _canon.clear();
+                        break;
+                }
+            }
+
+            template<class NODE> void operator()(const ir::code &code, ir::word pos, const NODE &node)
+            {
+                semantics sem(code, pos);
+                if (sem.is<ir::arithmetic>() || sem.is<ir::compare>() || sem.is<ir::Cast>() || sem.is<ir::Conv>())
+                    number(code, pos, { node.id(), canon(node[0]), node.nargs() > 1? canon(node[1]) : -1 }, node);
+                else if (ir::node_index::is_pure(node.id())) _out(pos, node);
+                else statement(code, pos, node);
+            }
+
+            void operator()(const ir::code &code, ir::word pos, const ir::Imm &node)
+            {
+                number(code, pos, { node.id(), node[0], 0 }, node);
+            }
+
+            void operator()(const ir::code &code, ir::word pos, const ir::Arg &node)
+            {
+                number(code, pos, { node.id(), canon(node[0]), node[1] }, node);
+            }
+        };
+
+        // Loop optimizations on structured code. Expressions that do not change in a loop are
+        // computed into Temps before its Forever, in the outermost loop they are invariant in.
+        // Products of an induction variable and an invariant factor get Temps of their own, which
+        // are stepped right after the variable. Div is never hoisted, as it could trap in a loop
+        // that would never have executed it.
+        class loop_pass
+        {
+            struct loop
+            {
+                ir::word _forever, _repeat, _parent;
+                std::map<ir::word, ir::word> _writes, _writer; // the number of writes to each Temp, and the last one
+            };
+
+            // Node numbers, except _temp and _delta, which are positions in the remapper
+            struct hoist
+            {
+                ir::word _node, _loop, _iv, _factor, _step, _stmt;
+                bool _sub;
+                ir::word _temp, _delta;
+            };
+
+            struct copier
+            {
+                loop_pass &_pass;
+                ir::word _limit, _pos;
+
+                template<class NODE> void operator()(const ir::code &, ir::word, const NODE &node)
+                {
+                    NODE onode = node;
+                    for (unsigned i = 0; i < node.nargs(); ++i) if (node.is_id(i)) onode[i] = _pass.copy(node[i], _limit);
+                    _pos = _pass._out.add(onode);
+                }
+            };
+
+            const ir::code &_code;
+            const ir::node_index &_nodes;
+            remapper<ir::code> _out;
+            std::vector<loop> _loops;
+            std::vector<hoist> _hoists;
+            std::vector<ir::word> _loop_of, _first, _last, _here, _skips, _plan, _mark;
+            std::map<ir::word, ir::word> _copies;
+
+            ir::word arg(ir::word n, unsigned i) const
+            {
+                return _nodes.number(_nodes.arguments(n)[i]);
+            }
+
+            template<class F> void for_args(ir::word n, const F &f) const
+            {
+                ir::word id = _nodes.id(n);
+                for (ir::word i = 0; i < _nodes.nargs(n); ++i)
+                    if (ir::node_index::is_id(id, i) && _nodes.arguments(n)[i] >= 0 && _nodes.arguments(n)[i] < _nodes.pos(n)) f(arg(n, i));
+            }
+
+            static bool is_statement(ir::word id)
+            {
+                return !ir::node_index::is_pure(id) && id != ir::node_id::Mem;
+            }
+
+            bool is_constant(ir::word n) const
+            {
+                return _nodes.id(n) == ir::node_id::Imm || (_nodes.id(n) == ir::node_id::Cast && _nodes.id(arg(n, 1)) == ir::node_id::Imm);
+            }
+
+            ir::word value(ir::word n) const
+            {
+                return _nodes.id(n) == ir::node_id::Imm? _nodes.arguments(n)[0] : value(arg(n, 1));
+            }
+
+            void analyze()
+            {
+                ir::word count = _nodes.count();
+                _loop_of.assign(count, -1);
+                _first.assign(count, -1);
+                _last.assign(count, -1);
+                _here.assign(count, -1);
+                _plan.assign(count, -1);
+                _mark.assign(count, -1);
+                std::vector<ir::word> open, stack;
+                for (ir::word n = 0; n < count; ++n)
+                {
+                    ir::word id = _nodes.id(n);
+                    if (!is_statement(id)) continue;
+                    if (id == ir::node_id::Repeat)
+                    {
+                        _loops[open.back()]._repeat = n;
+                        open.pop_back();
+                    }
+                    _loop_of[n] = open.empty()? -1 : open.back();
+                    switch (id)
+                    {
+                        case ir::node_id::Forever:
+                            _loops.push_back({ n, count, _loop_of[n], { }, { } });
+                            open.push_back(_loops.size() - 1);
+                            break;
+                        case ir::node_id::Skip:
+                        case ir::node_id::SkipIf:
+                            _skips.push_back(n);
+                            break;
+                        case ir::node_id::Here:
+                            _here[arg(n, 0)] = n;
+                            break;
+                    }
+                    if (ir::node_index::is_write(id) && _nodes.id(arg(n, 0)) == ir::node_id::Temp)
+                        for (ir::word l = _loop_of[n]; l >= 0; l = _loops[l]._parent)
+                        {
+                            ++_loops[l]._writes[arg(n, 0)];
+                            _loops[l]._writer[arg(n, 0)] = n;
+                        }
+
+                    // The first and the last statement using each pure node, directly or not
+                    for_args(n, [&](ir::word e) { stack.push_back(e); });
+                    while (!stack.empty())
+                    {
+                        ir::word e = stack.back();
+                        stack.pop_back();
+                        if (_mark[e] == n || !ir::node_index::is_pure(_nodes.id(e))) continue;
+                        _mark[e] = n;
+                        if (_first[e] < 0) _first[e] = n;
+                        _last[e] = n;
+                        for_args(e, [&](ir::word a) { stack.push_back(a); });
+                    }
+                }
+            }
+
+            bool invariant(ir::word e, ir::word l) const
+            {
+                auto &lp = _loops[l];
+                switch (_nodes.id(e))
+                {
+                    case ir::node_id::Temp:
+                        return e < lp._forever && !lp._writes.count(e);
+                    case ir::node_id::Div:
+                        return false;
+                    case ir::node_id::Imm:
+                    case ir::node_id::Arg:
+                    case ir::node_id::Slot:
+                        return true;
+                }
+                semantics sem(_code, _nodes.pos(e));
+                if (!sem.is<ir::arithmetic>() && !sem.is<ir::compare>() && !sem.is<ir::Cast>() && !sem.is<ir::Conv>() && !sem.is<ir::typecon>()) return false;
+                bool result = true;
+                for_args(e, [&](ir::word a) { result = result && invariant(a, l); });
+                return result;
+            }
+
+            // Temp t is an induction variable of loop l, if it is written exactly once in the loop,
+            // on every iteration, by adding or subtracting an invariant step
+            bool induction(ir::word t, ir::word l, ir::word &step, bool &sub) const
+            {
+                auto &lp = _loops[l];
+                auto wi = lp._writes.find(t);
+                if (_nodes.id(t) != ir::node_id::Temp || t > lp._forever || wi == lp._writes.end() || wi->second != 1) return false;
+                ir::word s = lp._writer.at(t);
+                if (_loop_of[s] != l || _nodes.id(s) != ir::node_id::Move) return false;
+                for (auto k : _skips) if (k > lp._forever && k < s && _here[k] > s && _here[k] < lp._repeat) return false;
+                ir::word src = arg(s, 1);
+                sub = _nodes.id(src) == ir::node_id::Sub;
+                if (!sub && _nodes.id(src) != ir::node_id::Add) return false;
+                if (arg(src, 0) == t) step = arg(src, 1);
+                else if (!sub && arg(src, 1) == t) step = arg(src, 0);
+                else return false;
+                return invariant(step, l);
+            }
+
+            bool hoistable(ir::word e) const
+            {
+                switch (_nodes.id(e))
+                {
+                    case ir::node_id::Add:
+                    case ir::node_id::Sub:
+                    case ir::node_id::Mul:
+                    case ir::node_id::And:
+                    case ir::node_id::Or:
+                    case ir::node_id::Xor:
+                    case ir::node_id::Neg:
+                    case ir::node_id::Not:
+                        break;
+                    default:
+                        return false;
+                }
+                semantics sem(_code, _nodes.pos(e));
+                return sem.type().is<ir::Int>() && !sem.is_bool();
+            }
+
+            bool encloses(ir::word outer, ir::word l) const
+            {
+                while (l >= 0 && l != outer) l = _loops[l]._parent;
+                return l == outer;
+            }
+
+            // Plans e and its subexpressions used by statement n. What is computed in front of loop
+            // bound may contain parts to be computed in front of loops further out.
+            void consider(ir::word e, ir::word n, ir::word bound = -1)
+            {
+                if (_mark[e] == n || _plan[e] >= 0) return;
+                _mark[e] = n;
+                if (!ir::node_index::is_pure(_nodes.id(e)) || _nodes.id(e) == ir::node_id::Temp) return;
+                if (hoistable(e))
+                {
+                    // The innermost loop with all the uses of e, and then the outermost one e is invariant in
+                    ir::word l = _loop_of[n], h = -1;
+                    while (l >= 0 && !(_loops[l]._forever < _first[e] && _last[e] < _loops[l]._repeat)) l = _loops[l]._parent;
+                    if (l >= 0 && bound < 0 && _nodes.id(e) == ir::node_id::Mul) for (unsigned k = 0; k < 2; ++k)
+                    {
+                        ir::word step;
+                        bool sub;
+                        if (induction(arg(e, k), l, step, sub) && invariant(arg(e, 1 - k), l))
+                        {
+                            _plan[e] = _hoists.size();
+                            _hoists.push_back({ e, l, arg(e, k), arg(e, 1 - k), step, _loops[l]._writer.at(arg(e, k)), sub, -1, -1 });
+                            consider(arg(e, 1 - k), n, l);
+                            return;
+                        }
+                    }
+                    for (; l >= 0 && invariant(e, l); l = _loops[l]._parent) h = l;
+                    if (h >= 0 && (bound < 0 || (h != bound && encloses(h, bound))))
+                    {
+                        _plan[e] = _hoists.size();
+                        _hoists.push_back({ e, h, -1, -1, -1, -1, false, -1, -1 });
+                        bound = h;
+                    }
+                }
+                for_args(e, [&](ir::word a) { consider(a, n, bound); });
+            }
+
+            void plan()
+            {
+                _mark.assign(_nodes.count(), -1);
+                for (ir::word n = 0; n < _nodes.count(); ++n)
+                    if (_loop_of[n] >= 0 && is_statement(_nodes.id(n))) for_args(n, [&](ir::word e) { consider(e, n); });
+            }
+
+            // Copies the expression at pos in front of the loop starting at limit
+            ir::word copy(ir::word pos, ir::word limit)
+            {
+                ir::word p = _plan[_nodes.number(pos)];
+                if (pos < limit || (p >= 0 && _nodes.pos(_loops[_hoists[p]._loop]._forever) < limit)) return pos;
+                auto ci = _copies.find(pos);
+                if (ci != _copies.end()) return ci->second;
+                copier c{ *this, limit, -1 };
+                _code.pass_at(c, pos);
+                return _copies[pos] = c._pos;
+            }
+
+            void enter(ir::word f)
+            {
+                ir::word limit = _nodes.pos(f);
+                _copies.clear();
+                for (auto &h : _hoists) if (_loops[h._loop]._forever == f)
+                {
+                    ir::word pos = _nodes.pos(h._node), ty = copy(semantics(_code, pos).type().pos(), limit);
+                    h._temp = _out.add(ir::Temp(ty));
+                    _out(ir::Move(h._temp, copy(pos, limit)));
+                    if (h._iv < 0) continue;
+                    if (is_constant(h._step) && value(h._step) == 1) h._delta = copy(_nodes.pos(h._factor), limit);
+                    else if (is_constant(h._step) && is_constant(h._factor))
+                    {
+                        std::uint_least64_t step = value(h._step), factor = value(h._factor);
+                        h._delta = _out.add(ir::Cast(ty, _out.add(ir::Imm(step * factor))));
+                    }
+                    else
+                    {
+                        h._delta = _out.add(ir::Temp(ty));
+                        _out(ir::Move(h._delta, _out.add(ir::Mul(copy(_nodes.pos(h._step), limit), copy(_nodes.pos(h._factor), limit)))));
+                    }
+                }
+                for (auto &h : _hoists) if (_loops[h._loop]._forever == f) _out.map(h._temp, _nodes.pos(h._node));
+            }
+
+            void step(ir::word s)
+            {
+                for (auto &h : _hoists) if (h._stmt == s)
+                {
+                    if (h._sub) _out(ir::Move(h._temp, _out.add(ir::Sub(h._temp, h._delta))));
+                    else _out(ir::Move(h._temp, _out.add(ir::Add(h._temp, h._delta))));
+                }
+            }
+
+        public:
+
+            loop_pass(const ir::code &code, ir::code &out) : _code(code), _nodes(code.nodes()), _out(out)
+            {
+                analyze();
+                plan();
+            }
+
+            template<class NODE> void operator()(const ir::code &, ir::word pos, const NODE &node)
+            {
+                ir::word n = _nodes.number(pos), p = _plan[n];
+                // Inside their loops, hoisted nodes are already mapped to their Temps
+                if (p >= 0 && n > _loops[_hoists[p]._loop]._forever) return;
+                if (node.id() == ir::node_id::Forever) enter(n);
+                _out(pos, node);
+                if (is_statement(node.id())) step(n);
+            }
+        };
     }
 
     static ir::code simplify(const ir::code &code, unsigned n)
@@ -491,6 +913,19 @@ namespace codegen
         }
         return c[n & 1];
     }
+
+    // The loop optimizations are applied after simplification, because simplify would undo them
+    // by substituting the Temps that are only assigned once. The code must be structured.
+    static ir::code optimize(const ir::code &code, unsigned n)
+    {
+        ir::code simple = simplify(code, n), numbered, out;
+        remapper<ir::code> rn(numbered);
+        simplifier::value_numbering vn(rn);
+        simple.pass(vn);
+        simplifier::loop_pass loops(numbered, out);
+        numbered.pass(loops);
+        return out;
+    }
 }
 
 #endif
@@ -0,0 +1,155 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+codegen::function_module<std::int64_t(std::int64_t)> arena_test_module(std::int64_t k)
+{
+    x86::assembler a;
+    a(x86::MOV(x86::RAX, X));
+    a(x86::ADD(x86::RAX, k));
+    a(x86::RET());
+    return a.assemble_function<std::int64_t(std::int64_t)>();
+}
+
+TEST(Arena, Link)
+{
+    // An arena maps memory in chunks (1 MiB by default) and links modules next to each other in
+    // them, instead of giving each linked module pages of its own.
+    codegen::arena ar;
+    std::vector<codegen::function<std::int64_t(std::int64_t)>> funs;
+
+    // Every link seals its text pages, and the next link starts on a fresh page, so a hundred
+    // small functions linked one at a time still fit in one chunk, but a thousand of them do not.
+    for (int k = 0; k < 100; ++k) funs.push_back(arena_test_module(k).link(ar));
+    for (int k = 0; k < 100; ++k) ASSERT_EQ(42 + k, funs[k](42));
+    ASSERT_EQ(1 << 20, ar.mapped());
+
+    // A thousand small functions linked in a batch share their pages, and fit in one chunk.
+    {
+        codegen::arena::batch b(ar);
+        for (int k = 100; k < 1000; ++k) funs.push_back(arena_test_module(k).link(ar));
+    }
+    for (int k = 0; k < 1000; ++k) ASSERT_EQ(42 + k, funs[k](42));
+    ASSERT_EQ(1 << 20, ar.mapped());
+
+    // Modules with data work just the same, and the data is in the same chunk as the code.
+    x86::assembler a;
+    x86::global var;
+    a(x86::MOV(x86::RAX, x86::DS[var]));
+    a(x86::RET());
+    a.data();
+    a(var);
+    a(x86::DQ(123456));
+    ASSERT_EQ(123456, a.assemble_function<std::int64_t()>().link(ar)());
+    ASSERT_EQ(1 << 20, ar.mapped());
+
+    // The chunk is kept after all functions in it are gone, but a new chunk is created when the
+    // current one is full, and the old chunk is unmapped when the last function in it is gone.
+    // Functions are aligned at 16 bytes, so 65536 of these fit in a chunk.
+    funs.clear();
+    ASSERT_EQ(1 << 20, ar.mapped());
+    auto m = arena_test_module(42);
+    {
+        codegen::arena::batch b(ar);
+        for (int k = 0; k < 100000; ++k) funs.push_back(m.link(ar));
+    }
+    ASSERT_EQ(2 << 20, ar.mapped());
+    ASSERT_EQ(84, funs[0](42));
+    ASSERT_EQ(84, funs[99999](42));
+    funs.erase(funs.begin(), funs.begin() + 70000);
+    ASSERT_EQ(1 << 20, ar.mapped());
+    ASSERT_EQ(84, funs[29999](42));
+
+    // Anything too big to share a chunk nicely gets a chunk of its own, unless it fits in the
+    // current chunk.
+    codegen::arena small(64 << 10);
+    auto f = m.link(small);
+    a.clear();
+    a.data();
+    for (int i = 0; i < 40000; ++i) a(x86::DQ(i));
+    a.text();
+    a(x86::RET());
+    {
+        auto big = a.assemble_function<void()>().link(small);
+        ASSERT_LT(320000 + (64 << 10), small.mapped());
+        big();
+    }
+    ASSERT_EQ(64 << 10, small.mapped());
+    ASSERT_EQ(84, f(42));
+}
+
+TEST(Arena, Batch)
+{
+    codegen::arena ar;
+    std::vector<codegen::function<std::int64_t(std::int64_t)>> funs;
+
+    // Within a batch, the pages are made executable once, when the batch is committed, which
+    // throws if that fails, or else when it is destroyed. The functions linked in a batch cannot
+    // be called before that. Batches nest, and only the outermost one seals the pages.
+    {
+        codegen::arena::batch b(ar);
+        {
+            codegen::arena::batch inner(ar);
+            for (int k = 0; k < 1000; ++k) funs.push_back(arena_test_module(k).link(ar));
+            inner.commit();
+        }
+        b.commit();
+        for (int k = 0; k < 1000; ++k) ASSERT_EQ(k - 13, funs[k](-13));
+        b.commit();
+    }
+
+    // Linking more after the batch starts on a fresh page, and the functions on the last sealed
+    // page keep running, even while another batch is open.
+    funs.push_back(arena_test_module(1000).link(ar));
+    ASSERT_EQ(987, funs[1000](-13));
+    ASSERT_EQ(986, funs[999](-13));
+    {
+        codegen::arena::batch b(ar);
+        funs.push_back(arena_test_module(1001).link(ar));
+        ASSERT_EQ(986, funs[999](-13));
+        ASSERT_EQ(987, funs[1000](-13));
+    }
+    ASSERT_EQ(988, funs[1001](-13));
+}
+
+TEST(Arena, Release)
+{
+    codegen::arena ar;
+
+    // Releasing the last function linked does not give its sealed page back for writing, so the
+    // next function does not make the page of the one before it non-executable.
+    auto f = arena_test_module(1).link(ar);
+    {
+        auto g = arena_test_module(2).link(ar);
+        ASSERT_EQ(3, g(1));
+    }
+    auto h = arena_test_module(3).link(ar);
+    ASSERT_EQ(2, f(1));
+    ASSERT_EQ(4, h(1));
+
+    // Neither does releasing everything in the current chunk, which stays mapped.
+    f = h = codegen::function<std::int64_t(std::int64_t)>();
+    ASSERT_EQ(1 << 20, ar.mapped());
+    f = arena_test_module(4).link(ar);
+    {
+        codegen::arena::batch b(ar);
+        h = arena_test_module(5).link(ar);
+        ASSERT_EQ(5, f(1));
+    }
+    ASSERT_EQ(6, h(1));
+    ASSERT_EQ(1 << 20, ar.mapped());
+}
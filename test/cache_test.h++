@@ -0,0 +1,168 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+TEST(Cache, Memory)
+{
+    std::string codetext =
+        "[ fun: Enter [ Fun 0 [ Int -64 ] [ Int -64 ] [ Int -64] ] ]"
+        "[ Move [ RVal fun ] [ Add [ Arg fun 0 ] [ Arg fun 1 ] ] ]"
+        "[ Exit fun ]";
+
+    // The first build compiles the code, the second finds the same bytes of IR in the cache, and
+    // returns the function linked the first time.
+    code_cache cache;
+    ir::code code = textual(codetext).code();
+    auto f = build<std::int64_t(std::int64_t, std::int64_t)>(code, cache);
+    ir::code same = textual(codetext).code();
+    auto g = build<std::int64_t(std::int64_t, std::int64_t)>(same, cache);
+    ASSERT_EQ(42, f(19, 23));
+    ASSERT_EQ(42, g(19, 23));
+    ASSERT_EQ(1, cache.misses());
+    ASSERT_EQ(1, cache.hits());
+
+    // Any difference in the code is a different function.
+    ir::code other = textual("[ fun: Enter [ Fun 0 [ Int -64 ] [ Int -64 ] [ Int -64] ] ]"
+        "[ Move [ RVal fun ] [ Sub [ Arg fun 0 ] [ Arg fun 1 ] ] ]"
+        "[ Exit fun ]").code();
+    ASSERT_EQ(-4, build<std::int64_t(std::int64_t, std::int64_t)>(other, cache)(19, 23));
+    ASSERT_EQ(2, cache.misses());
+
+    // The functions outlive the cache entries.
+    cache.clear();
+    ASSERT_EQ(42, f(19, 23));
+    build<std::int64_t(std::int64_t, std::int64_t)>(code, cache);
+    ASSERT_EQ(3, cache.misses());
+}
+
+TEST(Cache, Directory)
+{
+    char directory[] = "/tmp/codegen_cache_test_XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(directory));
+
+    // Any module can be cached under a code; this one has data and relocations to it, which are
+    // kept in the file with the rest of the module.
+    ir::code code = textual("[ fun: Enter [ Fun 0 [ Int -64 ] ] ] [ Move [ RVal fun ] [ 123456 ] ] [ Exit fun ]").code();
+    int compiled = 0;
+    auto compile = [&]
+    {
+        ++compiled;
+        x86::assembler a;
+        x86::global var;
+        a(x86::MOV(x86::RAX, x86::DS[var]));
+        a(x86::RET());
+        a.data();
+        a(var);
+        a(x86::DQ(123456));
+        return a.assemble_function<std::int64_t()>();
+    };
+
+    {
+        code_cache cache(directory);
+        ASSERT_EQ(123456, cache.get<std::int64_t()>(code, compile)());
+        ASSERT_EQ(1, compiled);
+    }
+
+    // Another cache using the same directory, as in another process, links the module from the
+    // file without compiling it.
+    code_cache cache(directory);
+    ASSERT_EQ(123456, cache.get<std::int64_t()>(code, compile)());
+    ASSERT_EQ(1, compiled);
+    ASSERT_EQ(1, cache.loads());
+
+    // A broken file is just compiled again.
+    cache.clear();
+    std::ofstream(cache.file(code), std::ios::binary) << "garbage";
+    code_cache fresh(directory);
+    ASSERT_EQ(123456, fresh.get<std::int64_t()>(code, compile)());
+    ASSERT_EQ(2, compiled);
+
+    // So is a file cut short anywhere, or one with a size out of bounds: the sizes are 64 bit
+    // words after the format word, each of the IR, text and data followed by their bytes, and
+    // then the size of bss.
+    std::string good;
+    {
+        std::ifstream in(cache.file(code), std::ios::binary);
+        good.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    for (std::size_t n = 0; n < good.size(); ++n)
+    {
+        std::ofstream(cache.file(code), std::ios::binary) << good.substr(0, n);
+        code_cache truncated(directory);
+        ASSERT_EQ(123456, truncated.get<std::int64_t()>(code, compile)());
+        ASSERT_EQ(0, truncated.loads());
+    }
+    std::size_t bss = 8;
+    for (int i = 0; i < 3; ++i)
+    {
+        std::uint64_t n = 0;
+        for (int j = 0; j < 8; ++j) n |= (std::uint64_t)(unsigned char)good[bss + j] << 8 * j;
+        bss += 8 + n;
+    }
+    std::string huge = good;
+    huge[bss + 5] = 1;
+    std::ofstream(cache.file(code), std::ios::binary) << huge;
+    code_cache corrupt(directory);
+    ASSERT_EQ(123456, corrupt.get<std::int64_t()>(code, compile)());
+    ASSERT_EQ(0, corrupt.loads());
+    code_cache again(directory);
+    ASSERT_EQ(123456, again.get<std::int64_t()>(code, compile)());
+    ASSERT_EQ(1, again.loads());
+
+    // Modules compiled for other targets are kept in other files.
+    x86::features avx = x86::features::host(), plain;
+    avx._avx = true;
+    ASSERT_NE(cache.file(code, plain), cache.file(code, avx));
+
+    std::remove(cache.file(code).c_str());
+    rmdir(directory);
+}
+
+TEST(Cache, Capacity)
+{
+    auto constant = [](int n)
+    {
+        std::stringstream ss;
+        ss << "[ fun: Enter [ Fun 0 [ Int -64 ] ] ] [ Move [ RVal fun ] [ " << n << " ] ] [ Exit fun ]";
+        return textual(ss.str()).code();
+    };
+
+    // With room for two functions, using the first one again keeps it, and the second is
+    // evicted when the third is added.
+    code_cache cache(arena::shared(), "", 2);
+    auto one = constant(1), two = constant(2), three = constant(3);
+    build<std::int64_t()>(one, cache);
+    auto f = build<std::int64_t()>(two, cache);
+    build<std::int64_t()>(one, cache);
+    build<std::int64_t()>(three, cache);
+    ASSERT_EQ(2, cache.size());
+    ASSERT_EQ(3, cache.misses());
+    build<std::int64_t()>(one, cache);
+    ASSERT_EQ(2, cache.hits());
+    build<std::int64_t()>(two, cache);
+    ASSERT_EQ(4, cache.misses());
+
+    // An evicted function stays alive as long as it is used.
+    ASSERT_EQ(2, f());
+
+    // Erasing forgets one function, which is built again the next time.
+    ASSERT_TRUE(cache.erase(two));
+    ASSERT_FALSE(cache.erase(two));
+    ASSERT_EQ(1, cache.size());
+    ASSERT_EQ(2, build<std::int64_t()>(two, cache)());
+    ASSERT_EQ(5, cache.misses());
+}
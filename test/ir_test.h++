@@ -103,3 +103,53 @@ TEST(IR, Code)
     ASSERT_EQ(666, (*third)[0]);
     ASSERT_EQ(1234567890, (*third)[1]);
 }
+
+TEST(IR, Index)
+{
+    ir::code code;
+
+    auto i32 = code(ir::Int(-32));
+    auto fun = code(ir::Enter(code(ir::Fun(0, i32, i32, i32))));
+    auto x = code(ir::Arg(fun, 0));
+    auto y = code(ir::Arg(fun, 1));
+    auto sum = code(ir::Add(x, y));
+
+    // The index finds nodes by position and gives their arguments as a flat array, without
+    // decoding the buffer again.
+    auto &nodes = code.nodes();
+    ASSERT_EQ(6, nodes.count());
+    ASSERT_EQ(sum, nodes.pos(5));
+    ASSERT_EQ(5, nodes.number(sum));
+    ASSERT_EQ(ir::node_id::Add, nodes.id(5));
+    ASSERT_EQ(2, nodes.nargs(5));
+    ASSERT_EQ(x, nodes.arguments(5)[0]);
+    ASSERT_EQ(y, code.arg(sum, 1));
+    ASSERT_STREQ("Fun", ir::node_index::name(nodes.id(1)));
+
+    // The index follows the code as it grows, and knows the types of the nodes.
+    code(ir::Move(code(ir::RVal(fun)), sum));
+    ASSERT_EQ(8, code.nodes().count());
+    ASSERT_EQ(i32, nodes.type(nodes.number(sum)));
+    ASSERT_EQ(i32, nodes.type(6));
+    ASSERT_EQ(-1, nodes.type(7));
+    ir::word pos = sum;
+    ASSERT_TRUE(code.next(pos));
+    ASSERT_EQ(ir::node_id::RVal, code.nodes().id(code.nodes().number(pos)));
+
+    // Every node knows the nodes that use it, in order, as the code grows. Only arguments that are
+    // nodes count, not the numbers of Fun and Arg.
+    auto uses = [&](ir::word pos)
+    {
+        std::vector<ir::word> u;
+        for (auto p : code.uses(pos)) u.push_back(p);
+        return u;
+    };
+    auto rval = pos, move = code.nodes().pos(7);
+    auto twice = code(ir::Add(x, x));
+    ASSERT_EQ((std::vector<ir::word> { sum, twice, twice }), uses(x));
+    ASSERT_EQ((std::vector<ir::word> { move }), uses(sum));
+    ASSERT_EQ((std::vector<ir::word> { move }), uses(rval));
+    ASSERT_EQ((std::vector<ir::word> { x, y, rval }), uses(fun));
+    ASSERT_EQ((std::vector<ir::word> { code.nodes().pos(1), code.nodes().pos(1), code.nodes().pos(1) }), uses(i32));
+    ASSERT_TRUE(code.uses(twice).empty());
+}
@@ -33,11 +33,20 @@
 
 using namespace codegen;
 
+#include "samples.h++"
+
 #include "ir_test.h++"
 
 #include "x86_asm_test.h++"
 #include "x86_gen_test.h++"
 #include "x86_rtl_test.h++"
+#include "ra_test.h++"
+#include "simd_test.h++"
+
+#include "arena_test.h++"
+#include "parallel_test.h++"
+#include "cache_test.h++"
+#include "profile_test.h++"
 
 #include "textual_test.h++"
 #include "control_test.h++"
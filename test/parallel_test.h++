@@ -0,0 +1,79 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+TEST(Parallel, For)
+{
+    // Every index is done exactly once, however the work is spread over the threads. The first
+    // indices are much slower than the rest, so the other workers have to steal them.
+    std::vector<std::atomic<int>> done(1000);
+    std::vector<unsigned> workers(1000);
+    parallel_for(done.size(), 4, [&](unsigned worker, std::size_t i)
+    {
+        if (i < 10) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ++done[i];
+        workers[i] = worker;
+    });
+    for (auto &d : done) ASSERT_EQ(1, d);
+    for (auto w : workers) ASSERT_LT(w, 4);
+
+    // An exception stops the loop and comes out of parallel_for on the calling thread.
+    ASSERT_THROW(parallel_for(1000, 4, [](unsigned, std::size_t i) { if (i == 500) throw i; }), std::size_t);
+
+    // Nothing to do, or only one thread to do it with
+    parallel_for(0, 4, [](unsigned, std::size_t) { FAIL(); });
+    int n = 0;
+    parallel_for(10, 1, [&](unsigned worker, std::size_t) { ASSERT_EQ(0, worker); ++n; });
+    ASSERT_EQ(10, n);
+}
+
+TEST(Parallel, Build)
+{
+    // build compiles a vector of functions on many threads at once, each thread with a compiler
+    // of its own, and links them all into the arena in one batch.
+    std::vector<ir::code> codes(500);
+    for (int k = 0; k < 500; ++k)
+    {
+        auto &code = codes[k];
+        auto i64 = code(ir::Int(-64));
+        auto fun = code(ir::Enter(code(ir::Fun(0, i64, i64, i64))));
+        code(ir::Move(code(ir::RVal(fun)), code(ir::Add(code(ir::Mul(code(ir::Arg(fun, 0)), code(ir::Imm(k)))), code(ir::Arg(fun, 1))))));
+        code(ir::Exit(fun));
+    }
+
+    codegen::arena ar;
+    auto funs = build<std::int64_t(std::int64_t, std::int64_t)>(codes, ar, 4);
+    ASSERT_EQ(500, funs.size());
+    for (int k = 0; k < 500; ++k) ASSERT_EQ(2 * k + 1, funs[k](2, 1));
+
+    // The functions can be copied and destroyed on any thread.
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+        threads.emplace_back([&funs, t]
+        {
+            for (int k = t; k < 500; k += 4)
+            {
+                auto copy = funs[k];
+                funs[k] = function<std::int64_t(std::int64_t, std::int64_t)>();
+                if (copy(2, 1) != 2 * k + 1) throw k;
+            }
+        });
+    for (auto &t : threads) t.join();
+
+    // All the functions are gone, and only the current chunk of the arena is left.
+    ASSERT_EQ(1 << 20, ar.mapped());
+}
@@ -0,0 +1,228 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// A loop whose body is too long for a short branch back to its head
+ir::code profile_test_loop()
+{
+    ir::code code;
+    auto i64 = code(ir::Int(-64));
+    auto fun = code(ir::Enter(code(ir::Fun(0, i64, i64, i64))));
+    auto i = code(ir::Temp(i64)), s = code(ir::Temp(i64));
+    code(ir::Move(i, code(ir::Imm(0))));
+    code(ir::Move(s, code(ir::Arg(fun, 1))));
+    auto top = code(ir::Label());
+    code(ir::Mark(top));
+    for (int k = 0; k < 50; ++k) code(ir::Move(s, code(ir::Xor(code(ir::Add(s, i)), code(ir::Imm(k))))));
+    code(ir::Move(i, code(ir::Add(i, code(ir::Imm(1))))));
+    code(ir::Branch(top, code(ir::Lt(i, code(ir::Arg(fun, 0))))));
+    code(ir::Move(code(ir::RVal(fun)), s));
+    code(ir::Exit(fun));
+    return code;
+}
+
+TEST(Profile, Stats)
+{
+    // A function that spills
+    ir::code code = sample_chain(300, 40);
+    compiler c;
+    compile_stats stats;
+    c.profile(&stats);
+    auto m = c.compile<std::int64_t(std::int64_t, std::int64_t)>(code);
+
+    ASSERT_EQ(1u, stats._functions);
+    ASSERT_EQ((std::size_t)code.nodes().count(), stats._nodes);
+    ASSERT_EQ((std::size_t)code.size(), stats._bytes);
+    for (int k : { compile_stats::pre_ra, compile_stats::rtl, compile_stats::ra })
+    {
+        ASSERT_LT(0u, stats._stages[k]._nodes) << compile_stats::stage_name(k);
+        ASSERT_LT(0u, stats._stages[k]._bytes) << compile_stats::stage_name(k);
+    }
+    ASSERT_LT(0, stats.seconds());
+    ASSERT_LT(0u, stats._spilled);
+    ASSERT_LT(0u, stats._slot_words);
+    ASSERT_LT(0u, stats._loads);
+    ASSERT_LT(0u, stats._stores);
+    ASSERT_LT(0u, stats._instructions);
+    ASSERT_EQ(0u, stats._relaxation_rounds);
+    ASSERT_EQ(m.text().size(), stats._text);
+    ASSERT_EQ(0u, stats._bss);
+
+    // The stats of the next functions add up, until the compiler is told to stop
+    auto f = c.build<std::int64_t(std::int64_t, std::int64_t)>(code, arena::shared());
+    ASSERT_EQ((std::int64_t)sample_chain_value(300, 40, 5, 77), f(5, 77));
+    ASSERT_EQ(2u, stats._functions);
+    ASSERT_EQ(2 * m.text().size(), stats._text);
+    ASSERT_LT(0, stats._stages[compile_stats::link]._seconds);
+
+    // One round finds the branch back to the head of the loop too short, and relaxes it
+    compile_stats loop;
+    c.profile(&loop);
+    c.compile<std::int64_t(std::int64_t, std::int64_t)>(profile_test_loop());
+    ASSERT_EQ(1u, loop._relaxation_rounds);
+
+    c.profile(nullptr);
+    c.compile<std::int64_t(std::int64_t, std::int64_t)>(code);
+    ASSERT_EQ(2u, stats._functions);
+
+    std::ostringstream report;
+    stats.write(report);
+    ASSERT_NE(std::string::npos, report.str().find("2 functions"));
+}
+
+TEST(Profile, PerfMap)
+{
+    char directory[] = "/tmp/codegen_profile_test_XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(directory));
+    std::string pid = std::to_string(getpid());
+    ir::code code = sample_chain(10, 4);
+    using F = std::int64_t(std::int64_t, std::int64_t);
+
+    // A line of the address and size in hex and the name of each function
+    std::string path = std::string(directory) + "/perf-" + pid + ".map";
+    {
+        perf_map map(perf_map::map, directory);
+        compiler c;
+        c.perf(&map);
+        auto f = c.build<F>(code, arena::shared(), "chain");
+        auto g = c.build<F>(code, arena::shared());
+        std::ifstream in(path);
+        std::string line;
+        std::vector<std::string> lines;
+        while (std::getline(in, line)) lines.push_back(line);
+        ASSERT_EQ(2u, lines.size());
+        std::ostringstream expected;
+        expected << std::hex << (std::uintptr_t)f.address() << " " << c.compile<F>(code).text().size() << " chain";
+        ASSERT_EQ(expected.str(), lines[0]);
+        ASSERT_EQ(" codegen_1", lines[1].substr(lines[1].rfind(' ')));
+    }
+    std::remove(path.c_str());
+
+    // The jitdump has a header, a record with the name and the code of each function, and one
+    // at the end
+    path = std::string(directory) + "/jit-" + pid + ".dump";
+    std::vector<byte> text;
+    {
+        perf_map map(perf_map::jitdump, directory);
+        compiler c;
+        c.perf(&map);
+        c.build<F>(code, arena::shared(), "chain");
+        text = c.compile<F>(code).text();
+    }
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> dump((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    ASSERT_EQ(40 + 56 + 6 + text.size() + 16, dump.size());
+    std::uint32_t magic, id;
+    std::memcpy(&magic, dump.data(), 4);
+    std::memcpy(&id, dump.data() + 40, 4);
+    ASSERT_EQ(0x4a695444u, magic);
+    ASSERT_EQ(0u, id);
+    ASSERT_EQ(std::string("chain"), dump.data() + 40 + 56);
+    ASSERT_TRUE(std::equal(text.begin(), text.end(), (byte *)dump.data() + 40 + 56 + 6));
+    std::remove(path.c_str());
+    rmdir(directory);
+}
+
+TEST(Profile, Parallel)
+{
+    char directory[] = "/tmp/codegen_profile_test_XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(directory));
+    using F = std::int64_t(std::int64_t, std::int64_t);
+    std::vector<ir::code> codes;
+    for (int k = 1; k <= 8; ++k) codes.push_back(sample_chain(k, 4));
+    std::size_t text = 0;
+    for (auto &code : codes) text += compiler().compile<F>(code).text().size();
+
+    // The stats of the worker threads are added up, and every function is in the perf map
+    std::string path = std::string(directory) + "/perf-" + std::to_string(getpid()) + ".map";
+    {
+        compile_stats stats;
+        perf_map map(perf_map::map, directory);
+        auto funs = build<F>(codes, arena::shared(), &stats, &map, 3);
+        ASSERT_EQ(8u, stats._functions);
+        ASSERT_EQ(text, stats._text);
+        ASSERT_LT(0, stats._stages[compile_stats::link]._seconds);
+        for (int k = 1; k <= 8; ++k) ASSERT_EQ((std::int64_t)sample_chain_value(k, 4, 5, 77), funs[k - 1](5, 77));
+
+        std::ifstream in(path);
+        std::set<std::string> lines;
+        for (std::string line; std::getline(in, line); ) lines.insert(line);
+        ASSERT_EQ(8u, lines.size());
+        for (auto &f : funs)
+        {
+            std::ostringstream expected;
+            expected << std::hex << (std::uintptr_t)f.address() << " " << f.text_size() << " codegen_";
+            auto it = lines.lower_bound(expected.str());
+            ASSERT_TRUE(it != lines.end() && it->compare(0, expected.str().size(), expected.str()) == 0);
+        }
+    }
+    std::remove(path.c_str());
+    rmdir(directory);
+}
+
+TEST(Profile, Cache)
+{
+    char directory[] = "/tmp/codegen_profile_test_XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(directory));
+    using F = std::int64_t(std::int64_t, std::int64_t);
+    ir::code code = sample_chain(10, 4);
+
+    // Only the miss is compiled and counted, and only it goes to the perf map
+    std::string path = std::string(directory) + "/perf-" + std::to_string(getpid()) + ".map";
+    {
+        compile_stats stats;
+        perf_map map(perf_map::map, directory);
+        code_cache cache;
+        compiler c;
+        c.profile(&stats);
+        c.perf(&map);
+        auto f = c.build<F>(code, cache, "chain");
+        auto g = c.build<F>(code, cache, "chain");
+        ASSERT_EQ(1u, cache.hits());
+        ASSERT_EQ(1u, stats._functions);
+        ASSERT_EQ(f.address(), g.address());
+        ASSERT_EQ(c.compile<F>(code).text().size(), f.text_size());
+
+        std::ifstream in(path);
+        std::vector<std::string> lines;
+        for (std::string line; std::getline(in, line); ) lines.push_back(line);
+        std::ostringstream expected;
+        expected << std::hex << (std::uintptr_t)f.address() << " " << f.text_size() << " chain";
+        ASSERT_EQ(std::vector<std::string> { expected.str() }, lines);
+
+        // A function loaded from a file is new to this process, so it is written too
+        ir::code other = sample_chain(3, 2);
+        char files[] = "/tmp/codegen_profile_test_XXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(files));
+        code_cache(files).get<F>(other, [&] { return compiler().compile<F>(other); });
+        code_cache from_file(files);
+        auto compiled = stats._functions;
+        c.build<F>(other, from_file, "loaded");
+        c.build<F>(other, from_file, "loaded");
+        ASSERT_EQ(1u, from_file.loads());
+        ASSERT_EQ(1u, from_file.hits());
+        ASSERT_EQ(compiled, stats._functions);
+        in.clear();
+        for (std::string line; std::getline(in, line); ) lines.push_back(line);
+        ASSERT_EQ(2u, lines.size());
+        ASSERT_EQ(" loaded", lines[1].substr(lines[1].rfind(' ')));
+        std::remove(from_file.file(other).c_str());
+        rmdir(files);
+    }
+    std::remove(path.c_str());
+    rmdir(directory);
+}
@@ -0,0 +1,160 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+TEST(LinearRA, Registers)
+{
+    // Few enough values to keep in registers, so no stack frame at all
+    ir::code code = sample_chain(100, 4);
+    auto f = build<std::int64_t(std::int64_t, std::int64_t)>(code);
+    ASSERT_EQ((std::int64_t)sample_chain_value(100, 4, 5, 77), f(5, 77));
+}
+
+TEST(LinearRA, Spills)
+{
+    // More values live at a time than there are registers. The callee saved registers are saved
+    // when they are needed, and the rest of the values are spilled to the stack.
+    for (int w : { 12, 16, 40 })
+    {
+        ir::code code = sample_chain(300, w);
+        auto f = build<std::int64_t(std::int64_t, std::int64_t)>(code);
+        ASSERT_EQ((std::int64_t)sample_chain_value(300, w, 5, 77), f(5, 77)) << w;
+    }
+}
+
+TEST(LinearRA, Loop)
+{
+    // k accumulators updated in a loop, each from the one before it. The accumulators are live
+    // around the loop, so their intervals cover it whole, spilled or not.
+    for (int k : { 3, 20 })
+    {
+        ir::code code;
+        auto i64 = code(ir::Int(-64));
+        auto fun = code(ir::Enter(code(ir::Fun(0, i64, i64, i64))));
+        auto i = code(ir::Temp(i64));
+        std::vector<ir::word> a;
+        code(ir::Move(i, code(ir::Imm(0))));
+        for (int j = 0; j < k; ++j)
+        {
+            a.push_back(code(ir::Temp(i64)));
+            code(ir::Move(a.back(), code(ir::Add(code(ir::Arg(fun, 1)), code(ir::Imm(j))))));
+        }
+        auto top = code(ir::Label());
+        code(ir::Mark(top));
+        for (int j = 0; j < k; ++j) code(ir::Move(a[j], code(ir::Add(a[j], code(ir::Xor(i, a[(j + k - 1) % k]))))));
+        code(ir::Move(i, code(ir::Add(i, code(ir::Imm(1))))));
+        code(ir::Branch(top, code(ir::Lt(i, code(ir::Arg(fun, 0))))));
+        auto sum = a[0];
+        for (int j = 1; j < k; ++j) sum = code(ir::Add(sum, a[j]));
+        code(ir::Move(code(ir::RVal(fun)), sum));
+        code(ir::Exit(fun));
+
+        std::vector<std::uint64_t> v;
+        for (int j = 0; j < k; ++j) v.push_back(3 + j);
+        for (std::uint64_t n = 0; n < 10; ++n) for (int j = 0; j < k; ++j) v[j] += n ^ v[(j + k - 1) % k];
+        std::uint64_t expected = 0;
+        for (auto x : v) expected += x;
+
+        auto f = build<std::int64_t(std::int64_t, std::int64_t)>(code);
+        ASSERT_EQ((std::int64_t)expected, f(10, 3)) << k;
+    }
+}
+
+TEST(LinearRA, AsGoodAsRA)
+{
+    // On the functions the old allocator and gen can handle together, the basic one and the branch
+    // operands from x86_rtl_test.h++ and the shortest chains, linear_ra spills nothing, as the old
+    // allocator cannot spill, and the code is no longer than with the old allocator.
+    using F = std::int64_t(std::int64_t, std::int64_t);
+    std::string basic =
+        "[ fun: Enter [ Fun 0 [ Int -64 ] [ Int -64 ] [ Int -64] ] ]"
+        "[ x: Temp [ Int -64 ] ]"
+        "[ y: Temp [ Int -64 ] ]"
+        "[ Move [ Reg x " + std::to_string(ir::x86::id(X)) + " ] [ Arg fun 0 ] ]" +
+        "[ Move [ Reg y " + std::to_string(ir::x86::id(Y)) + " ] [ Arg fun 1 ] ]" +
+        "[ r: Reg [ RVal fun ] " + std::to_string(ir::x86::id(x86::RAX)) + " ]"
+        "[ a: Add x y ]"
+        "[ b: Mul x [ 13 ] ]"
+        "[ Move r [ Add a b ] ]"
+        "[ Exit fun ]";
+
+    std::string branch =
+        "[ i64: Int -64 ]"
+        "[ fun: Enter [ Fun 0 i64 i64 i64 ] ]"
+        "[ t: Temp i64 ]"
+        "[ Move t [ Arg fun 0 ] ]"
+        "[ x: SkipIf [ Lt [ And t [ Cast i64 [ 1 ] ] ] [ Cast i64 [ 1 ] ] ] ]"
+        "[ Move t [ Mul t [ Arg fun 1 ] ] ]"
+        "[ Here x ]"
+        "[ Move [ RVal fun ] t ]"
+        "[ Exit fun ]";
+
+    std::vector<ir::code> codes = { textual(basic).code() };
+    std::vector<ir::code> sources = { control::unstructurized<ir::code>(textual(branch).code()) };
+    for (int n : { 1, 2, 3 }) for (int w : { 2, 4 }) sources.push_back(sample_chain(n, w));
+    for (auto &source : sources)
+    {
+        ir::code pre_ra;
+        x86::cc<ir::code>::pre_ra_gen pre_ra_gen(pre_ra);
+        source.pass(pre_ra_gen);
+        codes.push_back(pre_ra);
+    }
+
+    for (std::size_t k = 0; k < codes.size(); ++k)
+    {
+        ir::code rtl = x86::rtl<ir::code, 64>(codes[k]);
+        ir::code old_post_ra, post_ra;
+        ra<x86::regs64>().process(old_post_ra, rtl, 1);
+        linear_ra<x86::regs64> lra;
+        lra.process(post_ra, rtl);
+        ASSERT_EQ(0u, lra.stats()._spilled) << k;
+        ASSERT_LE(sample_text_size<F>(post_ra), sample_text_size<F>(old_post_ra)) << k;
+    }
+}
+
+TEST(LinearRA, Functions)
+{
+    // An allocator can take code with more than one function in it, and nothing of one function,
+    // like the slots of the callee saved registers the first one spills, is carried into the next.
+    ir::code pre_ra;
+    for (int w : { 40, 2 })
+    {
+        x86::cc<ir::code>::pre_ra_gen pre_ra_gen(pre_ra);
+        sample_chain(300, w).pass(pre_ra_gen);
+    }
+    ir::code rtl = x86::rtl<ir::code, 64>(pre_ra), post_ra;
+    linear_ra<x86::regs64> lra;
+    lra.process(post_ra, rtl);
+    ASSERT_LT(0u, lra.stats()._spilled);
+
+    // The second function refers to nothing before it
+    auto &nodes = post_ra.nodes();
+    ir::word second = -1;
+    for (ir::word n = 0; n < nodes.count(); ++n)
+        if (nodes.id(n) == ir::node_id::Exit)
+        {
+            second = n + 1;
+            break;
+        }
+    ASSERT_LT(second, nodes.count());
+    for (ir::word n = second; n < nodes.count(); ++n)
+        for (ir::word k = 0; k < nodes.nargs(n); ++k)
+            if (ir::node_index::is_id(nodes.id(n), k) && nodes.arguments(n)[k] >= 0)
+            {
+                ASSERT_LE(nodes.pos(second), nodes.arguments(n)[k]) << ir::node_index::name(nodes.id(n));
+            }
+}
@@ -0,0 +1,54 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// Sample functions and helpers shared by the tests and the benchmarks, which include this file
+// from here
+
+// A function of two arguments computing t[i] = (t[i - 1] + t[i - w]) ^ i for i up to n, starting
+// from t[0] and t[1] in the arguments, so that w values are live at a time
+ir::code sample_chain(int n, int w)
+{
+    ir::code code;
+    auto i64 = code(ir::Int(-64));
+    auto fun = code(ir::Enter(code(ir::Fun(0, i64, i64, i64))));
+    std::vector<ir::word> t = { code(ir::Arg(fun, 0)), code(ir::Arg(fun, 1)) };
+    for (int i = 0; i < n; ++i)
+    {
+        auto back = t.size() > (std::size_t)w? t[t.size() - w] : t[0];
+        t.push_back(code(ir::Xor(code(ir::Add(t.back(), back)), code(ir::Imm(i)))));
+    }
+    code(ir::Move(code(ir::RVal(fun)), t.back()));
+    code(ir::Exit(fun));
+    return code;
+}
+
+// What sample_chain(n, w) returns for the arguments a and b
+std::uint64_t sample_chain_value(int n, int w, std::uint64_t a, std::uint64_t b)
+{
+    std::vector<std::uint64_t> t = { a, b };
+    for (int i = 0; i < n; ++i) t.push_back((t.back() + t[t.size() > (std::size_t)w? t.size() - w : 0]) ^ i);
+    return t.back();
+}
+
+// The size of the machine code for a function after register allocation
+template<class F> std::size_t sample_text_size(const ir::code &post_ra)
+{
+    x86::function_gen<F> gen;
+    post_ra.pass(gen);
+    return gen.template module<F>().text().size();
+}
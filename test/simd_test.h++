@@ -0,0 +1,217 @@
+/*
+    codegen – a dynamic code generation library
+
+    Copyright 2018 Oskari Teirilä
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// Floats are IEEE single and double precision numbers, told apart by their significant digits
+ir::word simd_test_f32(ir::code &code)
+{
+    return code(ir::Float(2, -125, 128, 24));
+}
+
+ir::word simd_test_f64(ir::code &code)
+{
+    return code(ir::Float(2, -1021, 1024, 53));
+}
+
+// A double constant is the bits of it cast to a float
+ir::word simd_test_constant(ir::code &code, ir::word type, double x)
+{
+    std::int64_t bits;
+    std::memcpy(&bits, &x, 8);
+    return code(ir::Cast(type, code(ir::Imm(bits))));
+}
+
+TEST(SIMD, Scalar)
+{
+    // Scalar floats are in the XMM registers, both as arguments and return values, and their
+    // arithmetic is SSE2
+    ir::code code;
+    auto f64 = simd_test_f64(code);
+    auto fun = code(ir::Enter(code(ir::Fun(0, f64, f64, f64))));
+    auto x = code(ir::Arg(fun, 0)), y = code(ir::Arg(fun, 1));
+    auto half = simd_test_constant(code, f64, 0.5);
+    code(ir::Move(code(ir::RVal(fun)), code(ir::Div(code(ir::Mul(code(ir::Add(x, y)), x)), code(ir::Sub(y, half))))));
+    code(ir::Exit(fun));
+    auto f = build<double(double, double)>(code);
+    ASSERT_EQ((1.5 + 3.25) * 1.5 / (3.25 - 0.5), f(1.5, 3.25));
+
+    // Single precision, and conversions from and to integers and the other precision. The
+    // conversions to integers truncate like C does.
+    ir::code code2;
+    auto f32 = simd_test_f32(code2), d = simd_test_f64(code2), i64 = code2(ir::Int(-64)), i32 = code2(ir::Int(-32));
+    auto fun2 = code2(ir::Enter(code2(ir::Fun(0, i64, f32, d, i32))));
+    auto a = code2(ir::Conv(d, code2(ir::Arg(fun2, 0))));
+    auto b = code2(ir::Mul(a, code2(ir::Arg(fun2, 1))));
+    auto c = code2(ir::Conv(f32, code2(ir::Add(b, code2(ir::Conv(d, code2(ir::Arg(fun2, 2))))))));
+    code2(ir::Move(code2(ir::RVal(fun2)), code2(ir::Conv(i64, code2(ir::Add(c, code2(ir::Conv(f32, code2(ir::Imm(3))))))))));
+    code2(ir::Exit(fun2));
+    auto g = build<std::int64_t(float, double, std::int32_t)>(code2);
+    ASSERT_EQ((std::int64_t)((float)(2.5 * -4.25 + -100) + 3.0f), g(2.5f, -4.25, -100));
+    ASSERT_EQ(-107, g(2.5f, -4.25, -100));
+}
+
+// A compare whose value is moved is not typed in the whole pipeline, like in the X86Gen tests, so
+// that one goes straight to gen
+template<class NODE> bool simd_test_compare(double x, double y, bool branch)
+{
+    ir::code code;
+    auto f64 = simd_test_f64(code), b = code(ir::Int(0));
+    auto fun = code(ir::Enter(code(ir::Fun(0, b, f64, f64))));
+    auto argx = code(ir::Arg(fun, 0)), argy = code(ir::Arg(fun, 1));
+    if (branch)
+    {
+        auto r = code(ir::Temp(b)), yes = code(ir::Label());
+        code(ir::Move(r, code(ir::Imm(1))));
+        code(ir::Branch(yes, code(NODE(argx, argy))));
+        code(ir::Move(r, code(ir::Imm(0))));
+        code(ir::Mark(yes));
+        code(ir::Move(code(ir::RVal(fun)), r));
+        code(ir::Exit(fun));
+        return build<bool(double, double)>(code)(x, y);
+    }
+    auto rval = code(ir::RVal(fun));
+    code(ir::Move(code(ir::Reg(rval, ir::x86::id(x86::RAX))), code(NODE(code(ir::Reg(argx, ir::x86::id(x86::XMM0))), code(ir::Reg(argy, ir::x86::id(x86::XMM1)))))));
+    code(ir::Exit(fun));
+    x86::function_gen<bool(double, double)> gen;
+    code.pass(gen);
+    return gen.fun()(x, y);
+}
+
+template<class NODE, class C> void simd_test_compare(C compare)
+{
+    // Every compare with a NaN is false, apart from Neq
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    for (bool branch : { false, true })
+        for (double x : { -1.0, 2.0, nan })
+            for (double y : { -1.0, 2.0, nan })
+                ASSERT_EQ(compare(x, y), simd_test_compare<NODE>(x, y, branch)) << x << " " << y << " " << branch;
+}
+
+TEST(SIMD, Compare)
+{
+    simd_test_compare<ir::Eq>([](double x, double y) { return x == y; });
+    simd_test_compare<ir::Neq>([](double x, double y) { return x != y; });
+    simd_test_compare<ir::Lt>([](double x, double y) { return x < y; });
+    simd_test_compare<ir::Lte>([](double x, double y) { return x <= y; });
+    simd_test_compare<ir::Gt>([](double x, double y) { return x > y; });
+    simd_test_compare<ir::Gte>([](double x, double y) { return x >= y; });
+}
+
+TEST(SIMD, Spills)
+{
+    // More floats live at a time than there are XMM registers, none of which is callee saved.
+    // The additions are done in the same order as below, so the results are exactly the same.
+    for (int w : { 4, 24 })
+    {
+        ir::code code;
+        auto f64 = simd_test_f64(code);
+        auto fun = code(ir::Enter(code(ir::Fun(0, f64, f64, f64))));
+        std::vector<ir::word> t = { code(ir::Arg(fun, 0)), code(ir::Arg(fun, 1)) };
+        std::vector<double> v = { 0.25, 1.5 };
+        for (int i = 0; i < 200; ++i)
+        {
+            std::size_t back = t.size() > (std::size_t)w? t.size() - w : 0;
+            t.push_back(code(ir::Mul(code(ir::Add(t.back(), t[back])), simd_test_constant(code, f64, 0.75))));
+            v.push_back((v.back() + v[back]) * 0.75);
+        }
+        code(ir::Move(code(ir::RVal(fun)), t.back()));
+        code(ir::Exit(fun));
+        ASSERT_EQ(v.back(), build<double(double, double)>(code)(0.25, 1.5)) << w;
+    }
+}
+
+TEST(SIMD, Loop)
+{
+    // A dot product, loading the floats through pointers
+    ir::code code;
+    auto f32 = simd_test_f32(code), i64 = code(ir::Int(-64)), p = code(ir::Ptr(f32)), space = code(ir::Imm(0));
+    auto fun = code(ir::Enter(code(ir::Fun(0, f32, p, p, i64))));
+    auto a = code(ir::Temp(p)), b = code(ir::Temp(p)), n = code(ir::Temp(i64)), sum = code(ir::Temp(f32));
+    auto x = code(ir::Temp(f32)), y = code(ir::Temp(f32));
+    code(ir::Move(a, code(ir::Arg(fun, 0))));
+    code(ir::Move(b, code(ir::Arg(fun, 1))));
+    code(ir::Move(n, code(ir::Arg(fun, 2))));
+    code(ir::Move(sum, code(ir::Conv(f32, code(ir::Imm(0))))));
+    auto top = code(ir::Label());
+    code(ir::Mark(top));
+    code(ir::Ld(x, a, space, f32));
+    code(ir::Ld(y, b, space, f32));
+    code(ir::Move(sum, code(ir::Add(sum, code(ir::Mul(x, y))))));
+    code(ir::Move(a, code(ir::Add(a, code(ir::Imm(4))))));
+    code(ir::Move(b, code(ir::Add(b, code(ir::Imm(4))))));
+    code(ir::Move(n, code(ir::Sub(n, code(ir::Imm(1))))));
+    code(ir::Branch(top, code(ir::Gt(n, code(ir::Imm(0))))));
+    code(ir::Move(code(ir::RVal(fun)), sum));
+    code(ir::Exit(fun));
+
+    std::vector<float> u = { 1, 2, 3, 4, 5 }, v = { 0.5f, -1, 2, 0.25f, 4 };
+    ASSERT_EQ(0.5f - 2 + 6 + 1 + 20, (build<float(float *, float *, std::int64_t)>(code)(u.data(), v.data(), 5)));
+}
+
+// out = (a OP b) for arrays of n elements of type T
+template<class T, class NODE> void simd_test_packed(const x86::features &f, int n, bool flt, std::function<T(T, T)> op)
+{
+    ir::code code;
+    auto elem = flt? sizeof(T) == 4? simd_test_f32(code) : simd_test_f64(code) : code(ir::Int(-8 * (int)sizeof(T)));
+    auto vec = code(ir::Array(elem, n)), p = code(ir::Ptr(vec)), space = code(ir::Imm(0)), i64 = code(ir::Int(-64));
+    auto fun = code(ir::Enter(code(ir::Fun(0, i64, p, p, p))));
+    auto a = code(ir::Temp(vec)), b = code(ir::Temp(vec));
+    code(ir::Ld(a, code(ir::Arg(fun, 0)), space, vec));
+    code(ir::Ld(b, code(ir::Arg(fun, 1)), space, vec));
+    code(ir::St(code(ir::Arg(fun, 2)), code(NODE(a, b)), space, vec));
+    code(ir::Move(code(ir::RVal(fun)), code(ir::Imm(0))));
+    code(ir::Exit(fun));
+
+    std::vector<T> x(n), y(n), z(n);
+    for (int i = 0; i < n; ++i)
+    {
+        x[i] = T(3 * i + 1);
+        y[i] = T(n - i) / 2;
+    }
+    compiler c;
+    c.target(f);
+    c.build<std::int64_t(T *, T *, T *)>(code, arena::shared())(x.data(), y.data(), z.data());
+    for (int i = 0; i < n; ++i) ASSERT_EQ(op(x[i], y[i]), z[i]) << i;
+}
+
+template<class T, class NODE> void simd_test_packed(std::function<T(T, T)> op, bool flt = true)
+{
+    // Vectors of 128 bits with SSE, and with AVX on a processor that has it, which also does
+    // vectors of 256 bits
+    auto host = x86::features::host();
+    simd_test_packed<T, NODE>(x86::features(), 16 / sizeof(T), flt, op);
+    if (!host._avx) return;
+    simd_test_packed<T, NODE>(host, 16 / sizeof(T), flt, op);
+    if (flt || host._avx2) simd_test_packed<T, NODE>(host, 32 / sizeof(T), flt, op);
+}
+
+TEST(SIMD, Packed)
+{
+    simd_test_packed<float, ir::Add>([](float x, float y) { return x + y; });
+    simd_test_packed<float, ir::Sub>([](float x, float y) { return x - y; });
+    simd_test_packed<float, ir::Mul>([](float x, float y) { return x * y; });
+    simd_test_packed<float, ir::Div>([](float x, float y) { return x / y; });
+    simd_test_packed<double, ir::Add>([](double x, double y) { return x + y; });
+    simd_test_packed<double, ir::Div>([](double x, double y) { return x / y; });
+
+    simd_test_packed<std::int32_t, ir::Add>([](std::int32_t x, std::int32_t y) { return x + y; }, false);
+    simd_test_packed<std::int16_t, ir::Sub>([](std::int16_t x, std::int16_t y) { return std::int16_t(x - y); }, false);
+    simd_test_packed<std::int64_t, ir::Xor>([](std::int64_t x, std::int64_t y) { return x ^ y; }, false);
+
+    // Vectors of 256 bits need AVX
+    ASSERT_THROW((simd_test_packed<float, ir::Add>(x86::features(), 8, true, [](float x, float y) { return x + y; })), x86::unsupported_ir);
+}
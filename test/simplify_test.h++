@@ -48,3 +48,192 @@ TEST(Simplify, Basic)
 
     ASSERT_EQ(reference, result);
 }
+
+// Counts the nodes of a kind computed by the statements at loop depth d or deeper
+int simplify_test_loop_ops(const ir::code &code, ir::word id, int d)
+{
+    auto &nodes = code.nodes();
+    int count = 0, depth = 0;
+    std::vector<ir::word> stack;
+    for (ir::word n = 0; n < nodes.count(); ++n)
+    {
+        ir::word nid = nodes.id(n);
+        if (ir::node_index::is_pure(nid)) continue;
+        if (nid == ir::node_id::Forever) ++depth;
+        if (nid == ir::node_id::Repeat) --depth;
+        if (depth < d) continue;
+        for (ir::word i = 0; i < nodes.nargs(n); ++i)
+            if (ir::node_index::is_id(nid, i) && nodes.arguments(n)[i] >= 0) stack.push_back(nodes.number(nodes.arguments(n)[i]));
+        while (!stack.empty())
+        {
+            ir::word e = stack.back(), eid = nodes.id(e);
+            stack.pop_back();
+            if (!ir::node_index::is_pure(eid) || eid == ir::node_id::Temp) continue;
+            count += eid == id;
+            for (ir::word i = 0; i < nodes.nargs(e); ++i)
+                if (ir::node_index::is_id(eid, i) && nodes.arguments(e)[i] >= 0) stack.push_back(nodes.number(nodes.arguments(e)[i]));
+        }
+    }
+    return count;
+}
+
+template<class FUN> function<FUN> simplify_test_build(const ir::code &code)
+{
+    ir::code unstructured = control::unstructurized<ir::code>(code);
+    return build<FUN>(unstructured);
+}
+
+TEST(Simplify, LoopInvariants)
+{
+    // b * b and i * 7 are computed before the loop, the latter then stepped along with i
+    std::string loop =
+        "[ i64: Int -64 ]"
+        "[ fun: Enter [ Fun 0 i64 i64 i64 ] ]"
+        "[ i: Temp i64 ] [ s: Temp i64 ]"
+        "[ Move i [ Cast i64 [ 0 ] ] ] [ Move s [ Cast i64 [ 0 ] ] ]"
+        "[ l: Forever ]"
+        "[ x: SkipIf [ Gte i [ Arg fun 0 ] ] ]"
+        "[ Move s [ Add s [ Add [ Mul i [ Cast i64 [ 7 ] ] ] [ Mul [ Arg fun 1 ] [ Arg fun 1 ] ] ] ] ]"
+        "[ Move i [ Add i [ Cast i64 [ 1 ] ] ] ]"
+        "[ Repeat l ]"
+        "[ Here x ]"
+        "[ Move [ RVal fun ] s ]"
+        "[ Exit fun ]";
+
+    ir::code code = parse(loop), optimized = optimize(code, 4);
+    ASSERT_EQ(2, simplify_test_loop_ops(code, ir::node_id::Mul, 1));
+    ASSERT_EQ(0, simplify_test_loop_ops(optimized, ir::node_id::Mul, 1));
+
+    using F = std::int64_t(std::int64_t, std::int64_t);
+    auto f = simplify_test_build<F>(code), g = simplify_test_build<F>(optimized);
+    for (std::int64_t n : { 0, 1, 10, 1000 }) ASSERT_EQ(f(n, 3), g(n, 3)) << n;
+}
+
+TEST(Simplify, InductionVariables)
+{
+    // i counts down by b, so i * j is stepped by -(b * j), which is itself computed before the loop
+    std::string loop =
+        "[ i64: Int -64 ]"
+        "[ fun: Enter [ Fun 0 i64 i64 i64 i64 ] ]"
+        "[ i: Temp i64 ] [ j: Temp i64 ] [ s: Temp i64 ]"
+        "[ Move i [ Arg fun 0 ] ] [ Move j [ Add [ Arg fun 2 ] [ Cast i64 [ 1 ] ] ] ] [ Move s [ Cast i64 [ 0 ] ] ]"
+        "[ l: Forever ]"
+        "[ x: SkipIf [ Lte i [ Cast i64 [ 0 ] ] ] ]"
+        "[ Move s [ Xor [ Mul s [ Cast i64 [ 3 ] ] ] [ Mul i j ] ] ]"
+        "[ Move i [ Sub i [ Arg fun 1 ] ] ]"
+        "[ Move s [ Add s [ Mul j i ] ] ]"
+        "[ Repeat l ]"
+        "[ Here x ]"
+        "[ Move [ RVal fun ] s ]"
+        "[ Exit fun ]";
+
+    ir::code code = parse(loop), optimized = optimize(code, 4);
+    ASSERT_EQ(1, simplify_test_loop_ops(optimized, ir::node_id::Mul, 1));
+
+    using F = std::int64_t(std::int64_t, std::int64_t, std::int64_t);
+    auto f = simplify_test_build<F>(code), g = simplify_test_build<F>(optimized);
+    for (std::int64_t n : { 0, 1, 10, 1000 }) ASSERT_EQ(f(n, 3, 5), g(n, 3, 5)) << n;
+}
+
+TEST(Simplify, NestedLoops)
+{
+    // (i + b) * (a * a) is invariant in the inner loop only, but a * a in both of them. j * i is
+    // reduced in the inner loop, and k is not an induction variable, as it is only incremented on
+    // odd j.
+    std::string loops =
+        "[ i64: Int -64 ]"
+        "[ fun: Enter [ Fun 0 i64 i64 i64 ] ]"
+        "[ i: Temp i64 ] [ j: Temp i64 ] [ k: Temp i64 ] [ s: Temp i64 ]"
+        "[ Move i [ Cast i64 [ 0 ] ] ] [ Move k [ Cast i64 [ 0 ] ] ] [ Move s [ Cast i64 [ 1 ] ] ]"
+        "[ l1: Forever ]"
+        "[ x: SkipIf [ Gte i [ Arg fun 0 ] ] ]"
+        "[ Move j [ Cast i64 [ 0 ] ] ]"
+        "[ l2: Forever ]"
+        "[ y: SkipIf [ Gte j [ Arg fun 1 ] ] ]"
+        "[ Move s [ Add [ Add s [ Mul [ Add i [ Arg fun 1 ] ] [ Mul [ Arg fun 0 ] [ Arg fun 0 ] ] ] ] [ Mul j i ] ] ]"
+        "[ z: SkipIf [ Eq [ And j [ Cast i64 [ 1 ] ] ] [ Cast i64 [ 0 ] ] ] ]"
+        "[ Move k [ Add k [ Cast i64 [ 1 ] ] ] ]"
+        "[ Move s [ Xor s [ Add [ Arg fun 0 ] [ Cast i64 [ 1 ] ] ] ] ]"
+        "[ Here z ]"
+        "[ Move s [ Add s [ Mul k [ Cast i64 [ 5 ] ] ] ] ]"
+        "[ Move j [ Add j [ Cast i64 [ 1 ] ] ] ]"
+        "[ Repeat l2 ]"
+        "[ Here y ]"
+        "[ Move i [ Add i [ Cast i64 [ 2 ] ] ] ]"
+        "[ Repeat l1 ]"
+        "[ Here x ]"
+        "[ Move [ RVal fun ] s ]"
+        "[ Exit fun ]";
+
+    ir::code code = parse(loops), optimized = optimize(code, 4);
+    ASSERT_EQ(1, simplify_test_loop_ops(optimized, ir::node_id::Mul, 2));
+    ASSERT_EQ(2, simplify_test_loop_ops(optimized, ir::node_id::Mul, 1) - simplify_test_loop_ops(optimized, ir::node_id::Mul, 2));
+
+    std::int64_t s = 1, k = 0, a = 7, b = 9;
+    for (std::int64_t i = 0; i < a; i += 2)
+        for (std::int64_t j = 0; j < b; ++j)
+        {
+            s = s + (i + b) * (a * a) + j * i;
+            if (j & 1)
+            {
+                ++k;
+                s ^= a + 1;
+            }
+            s += k * 5;
+        }
+
+    using F = std::int64_t(std::int64_t, std::int64_t);
+    auto f = simplify_test_build<F>(code), g = simplify_test_build<F>(optimized);
+    ASSERT_EQ(s, f(a, b));
+    ASSERT_EQ(s, g(a, b));
+}
+
+TEST(Simplify, Division)
+{
+    // A division by zero must not happen, just because the loop was entered
+    std::string loop =
+        "[ i64: Int -64 ]"
+        "[ fun: Enter [ Fun 0 i64 i64 i64 ] ]"
+        "[ i: Temp i64 ] [ s: Temp i64 ]"
+        "[ Move i [ Cast i64 [ 0 ] ] ] [ Move s [ Cast i64 [ 0 ] ] ]"
+        "[ l: Forever ]"
+        "[ x: SkipIf [ Gte i [ Arg fun 0 ] ] ]"
+        "[ Move s [ Add s [ Div [ Arg fun 0 ] [ Arg fun 1 ] ] ] ]"
+        "[ Move i [ Add i [ Cast i64 [ 1 ] ] ] ]"
+        "[ Repeat l ]"
+        "[ Here x ]"
+        "[ Move [ RVal fun ] s ]"
+        "[ Exit fun ]";
+
+    ir::code optimized = optimize(parse(loop), 4);
+    ASSERT_EQ(1, simplify_test_loop_ops(optimized, ir::node_id::Div, 1));
+}
+
+TEST(Simplify, ValueNumbering)
+{
+    // a * b is first computed where it dominates the rest of the function, so it is a single node.
+    // t * b is computed in a block that may be skipped, and then after t is written, so none of
+    // the three can stand for another.
+    std::string branches =
+        "[ i64: Int -64 ]"
+        "[ fun: Enter [ Fun 0 i64 i64 i64 ] ]"
+        "[ t: Temp i64 ]"
+        "[ Move t [ Mul [ Arg fun 0 ] [ Arg fun 1 ] ] ]"
+        "[ x: SkipIf [ Gt t [ Cast i64 [ 10 ] ] ] ]"
+        "[ Move t [ Add [ Mul t [ Arg fun 1 ] ] [ Mul [ Arg fun 0 ] [ Arg fun 1 ] ] ] ]"
+        "[ Here x ]"
+        "[ Move t [ Sub [ Mul t [ Arg fun 1 ] ] [ Mul [ Arg fun 0 ] [ Arg fun 1 ] ] ] ]"
+        "[ Move t [ Xor [ Mul t [ Arg fun 1 ] ] [ Mul [ Arg fun 0 ] [ Arg fun 1 ] ] ] ]"
+        "[ Move [ RVal fun ] t ]"
+        "[ Exit fun ]";
+
+    ir::code code = parse(branches), optimized = optimize(code, 4);
+    int muls = 0;
+    auto &nodes = optimized.nodes();
+    for (ir::word n = 0; n < nodes.count(); ++n) muls += nodes.id(n) == ir::node_id::Mul;
+    ASSERT_EQ(4, muls);
+
+    using F = std::int64_t(std::int64_t, std::int64_t);
+    auto f = simplify_test_build<F>(code), g = simplify_test_build<F>(optimized);
+    for (std::int64_t a : { 1, 2, 5, 9 }) ASSERT_EQ(f(a, 2), g(a, 2)) << a;
+}
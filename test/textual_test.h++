@@ -25,3 +25,103 @@ TEST(Textual, Minimal)
     textual txt2(s);
     ASSERT_EQ(s, txt2.code().text());
 }
+
+// Labels, comments, negative numbers, Imm blocks, strings with escapes, and lists of arguments
+const char *textual_test_module =
+    "# a comment\n"
+    "[i64: Int -64][ p: ptr: Ptr i64 ]\n"
+    "[fun: Enter [Fun 0 i64 i64 i64 p]]   # another one\n"
+    "[t: Temp i64][Move t [Add [Arg fun 0] [ -12 ]]]\n"
+    "[Move t [Sub t [Cast i64 [Str 104 105]]]]\n"
+    "[St [Arg fun 2] \"a\\\"b\\\\c\\101\\\" [0] ptr]\n"
+    "[Move [RVal fun] [Mul t [Arg fun 1]]][Exit fun]\n";
+
+TEST(Textual, Stream)
+{
+    // The same code as textual gives, from memory and from a stream in chunks of any size,
+    // including the ones that cut every token in two
+    std::string text = textual_test_module;
+    auto expected = textual(text).code().bytes();
+    textual_stream parser;
+    ir::code code;
+    parser.parse(code, text);
+    ASSERT_EQ(expected, code.bytes());
+    for (std::size_t chunk : { 1, 2, 3, 7, 64, 4096 })
+    {
+        std::istringstream in(text);
+        ir::code code;
+        parser.parse(code, in, chunk);
+        ASSERT_EQ(expected, code.bytes()) << chunk;
+    }
+
+    // Each parse has symbols of its own
+    ASSERT_THROW(parser.parse(code, std::string("[Exit fun]")), textual::undefined_symbol<std::size_t>);
+}
+
+TEST(Textual, StreamFile)
+{
+    char path[] = "/tmp/codegen_textual_test_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+    std::string text;
+    for (int k = 0; k < 1000; ++k) text += textual_test_module;
+    ASSERT_EQ((ssize_t)text.size(), write(fd, text.data(), text.size()));
+    close(fd);
+
+    ir::code code;
+    textual_stream().parse_file(code, path);
+    ASSERT_EQ(textual(text).code().bytes(), code.bytes());
+    std::remove(path);
+    ASSERT_THROW(textual_stream().parse_file(code, path), textual_stream::file_error);
+}
+
+TEST(Textual, StreamErrors)
+{
+    // The errors are those of textual, at offsets in the input
+    ir::code code;
+    textual_stream parser;
+    try
+    {
+        parser.parse(code, std::string("[i64: Int -64]\n[Move x i64]"));
+        FAIL();
+    }
+    catch (const textual::undefined_symbol<std::size_t> &e)
+    {
+        ASSERT_EQ("x", e._sym);
+        ASSERT_EQ(21u, e._pos);
+    }
+    try
+    {
+        parser.parse(code, std::string("[Int -64 [Nothing]]"));
+        FAIL();
+    }
+    catch (const textual::syntax_error<std::size_t> &e)
+    {
+        ASSERT_EQ(10u, e._pos);
+    }
+
+    // A label is defined when its block ends, so it can't be used inside the block
+    ASSERT_THROW(parser.parse(code, std::string("[a: Add a a]")), textual::undefined_symbol<std::size_t>);
+    ASSERT_THROW(parser.parse(code, std::string("[Add [1] [2] [3]]")), textual::syntax_error<std::size_t>);
+    ASSERT_THROW(parser.parse(code, std::string("[Add [1] [2]")), textual::syntax_error<std::size_t>);
+    ASSERT_THROW(parser.parse(code, std::string("[Str \"abc]")), textual::syntax_error<std::size_t>);
+    ASSERT_THROW(parser.parse(code, std::string("[Int 6x4]")), textual::syntax_error<std::size_t>);
+
+    // Numbers are 64 bits, and the ones that don't fit are errors rather than wrapping around
+    ir::code limits, expected;
+    parser.parse(limits, std::string("[Add 9223372036854775807 -9223372036854775808]"));
+    ir::word args[] = { std::numeric_limits<ir::word>::max(), std::numeric_limits<ir::word>::min() };
+    expected(ir::node_id::Add, args, 2);
+    ASSERT_EQ(expected.bytes(), limits.bytes());
+    ASSERT_EQ(args[0], limits.arg(0, 0));
+    ASSERT_EQ(args[1], limits.arg(0, 1));
+    ASSERT_THROW(parser.parse(code, std::string("[Add 9223372036854775808 1]")), textual::syntax_error<std::size_t>);
+    ASSERT_THROW(parser.parse(code, std::string("[Add -9223372036854775809 1]")), textual::syntax_error<std::size_t>);
+    ASSERT_THROW(parser.parse(code, std::string("[Add 100000000000000000000 1]")), textual::syntax_error<std::size_t>);
+    ASSERT_THROW(parser.parse(code, std::string("[Add - 1]")), textual::syntax_error<std::size_t>);
+    ASSERT_THROW(parser.parse(code, std::string("[Add [-] 1]")), textual::syntax_error<std::size_t>);
+
+    // Nothing could be read in chunks of no bytes
+    std::istringstream in("[Add 1 2]");
+    ASSERT_THROW(parser.parse(code, in, 0), textual_stream::chunk_error);
+}
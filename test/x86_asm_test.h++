@@ -32,9 +32,9 @@
 
     Death tests for all invalid encodings (and make them pass, obviously).
 
-    SSE support, at least enough to have the basic floating point arithmetic for now. Full SIMD
-    support up to at least AVX2 should, of course, be implemented, but that can be done later. For
-    anything better than AVX2 I will need a newer processor.
+    The rest of SSE and AVX2. There is enough for scalar floating point arithmetic and packed
+    arithmetic on vectors, and not much else. For anything better than AVX2 I will need a newer
+    processor.
 */
 
 TEST(X86Asm, PlainReturn)
@@ -101,6 +101,14 @@ TEST(X86Asm, BasicBinaryInstructions)
     EXPECT_EQ(8, test_basic_binary_instruction<x86::AND>(13, 42));
     EXPECT_EQ(-29, test_basic_binary_instruction<x86::SUB>(13, 42));
     EXPECT_EQ(39, test_basic_binary_instruction<x86::XOR>(13, 42));
+
+    // A 64 bit operand takes a sign extended 32 bit immediate
+    x86::assembler a;
+    a(x86::MOV(x86::RAX, X));
+    a(x86::XOR(x86::RAX, 200));
+    a(x86::ADD(x86::RAX, 300));
+    a(x86::RET());
+    EXPECT_EQ(501, a.assemble_function<std::int64_t(std::int64_t)>().link()(1));
 }
 
 TEST(X86Asm, AddressModes)
@@ -282,6 +290,173 @@ TEST(X86Asm, JmpCall)
     a(x86::RET());
 
     ASSERT_EQ(0, a.assemble_function<std::int64_t(std::int64_t)>().link()(42));
+
+    // Jumps and calls to globals are near, and get their displacements when linked.
+    a.clear();
+    x86::global callee, tail;
+
+    a(x86::CALL(callee));
+    a(x86::JMP(tail));
+    a(callee);
+    a(x86::MOV(x86::RAX, X));
+    a(x86::RET());
+    a(tail);
+    a(x86::ADD(x86::RAX, 1));
+    a(x86::RET());
+
+    auto m = a.assemble_function<std::int64_t(std::int64_t)>();
+    ASSERT_EQ(0xe8, m.text()[0]);
+    ASSERT_EQ(0xe9, m.text()[5]);
+    ASSERT_EQ(43, m.link()(42));
+}
+
+TEST(X86Asm, BranchRelaxation)
+{
+    x86::assembler a;
+    x86::label yes(a), no(a);
+
+    // Branches use the short form when their targets are within reach, ...
+    a(x86::CMP(X, Y));
+    a(x86::JE(yes));
+    a(x86::XOR(x86::RAX, x86::RAX));
+    a(x86::RET());
+    a(yes);
+    a(x86::MOV(x86::RAX, 1));
+    a(x86::RET());
+
+    auto m = a.assemble_function<bool(std::int64_t, std::int64_t)>();
+    ASSERT_EQ(0x74, m.text()[3]);
+    ASSERT_TRUE(m.link()(42, 42));
+
+    // ... and the near form when they aren't. The JMP has to be near, which pushes the JE out of
+    // reach as well.
+    a.clear();
+    yes = x86::label(a);
+    no = x86::label(a);
+    a(x86::CMP(X, Y));
+    a(x86::JE(yes));
+    a(x86::JMP(no));
+    for (int i = 0; i < 124; ++i) a(x86::NOP());
+    a(yes);
+    a(x86::MOV(x86::RAX, 1));
+    a(x86::RET());
+    a(no);
+    a(x86::XOR(x86::RAX, x86::RAX));
+    a(x86::RET());
+
+    auto n = a.assemble_function<bool(std::int64_t, std::int64_t)>();
+    ASSERT_EQ(0x0f, n.text()[3]);
+    ASSERT_EQ(0x84, n.text()[4]);
+    ASSERT_EQ(0xe9, n.text()[9]);
+    ASSERT_TRUE(n.link()(42, 42));
+    ASSERT_FALSE(n.link()(42, 13));
+
+    // Shortening the filler by three bytes lets both branches be short again.
+    a.clear();
+    yes = x86::label(a);
+    no = x86::label(a);
+    a(x86::CMP(X, Y));
+    a(x86::JE(yes));
+    a(x86::JMP(no));
+    for (int i = 0; i < 121; ++i) a(x86::NOP());
+    a(yes);
+    a(x86::RET());
+    a(no);
+    a(x86::RET());
+
+    auto o = a.assemble_function<void(std::int64_t, std::int64_t)>();
+    ASSERT_EQ(0x74, o.text()[3]);
+    ASSERT_EQ(0xeb, o.text()[5]);
+    ASSERT_EQ(3 + 2 + 2 + 121 + 1 + 1, o.text().size());
+
+    // The reach is counted from the end of the branch, not from after the padding following it.
+    a.clear();
+    yes = x86::label(a);
+    a(x86::JMP(yes));
+    a.align(16);
+    a(x86::XOR(x86::RAX, x86::RAX));
+    a(x86::RET());
+    for (int i = 0; i < 121; ++i) a(x86::NOP());
+    a(yes);
+    a(x86::MOV(x86::RAX, 1));
+    a(x86::RET());
+
+    auto p = a.assemble_function<bool()>();
+    ASSERT_EQ(0xe9, p.text()[0]);
+    ASSERT_TRUE(p.link()());
+
+    // In a chain of branches each jumping over the next one, relaxing one pushes the one before it
+    // out of reach. That takes a round per branch, but each round only looks at the branches whose
+    // spans changed, so this takes time in proportion to the length of the chain.
+    a.clear();
+    std::vector<x86::label> targets;
+    const int chain = 1000;
+    for (int j = 0; j < chain; ++j) targets.emplace_back(a);
+    for (int j = 0; j < chain; ++j)
+    {
+        a(x86::JMP(targets[j]));
+        for (int i = 0; i < (j + 1 < chain? 62 : 200); ++i) a(x86::NOP());
+        if (j > 0) a(targets[j - 1]);
+    }
+    a(targets[chain - 1]);
+    a(x86::MOV(x86::RAX, 1));
+    a(x86::RET());
+
+    auto q = a.assemble_function<bool()>();
+    ASSERT_EQ((std::size_t)chain, a.relaxation_rounds());
+    ASSERT_EQ(5 * chain + 62 * (chain - 1) + 200 + 8, q.text().size());
+    ASSERT_TRUE(q.link()());
+
+    // A branch to a label that is never marked is an error, not a branch to the start of the code.
+    a.clear();
+    x86::label nowhere(a);
+    a(x86::CMP(X, Y));
+    a(x86::JE(nowhere));
+    a(x86::RET());
+    ASSERT_THROW((a.assemble_function<void(std::int64_t, std::int64_t)>()), x86::unmarked_label);
+}
+
+TEST(X86Asm, Align)
+{
+    x86::assembler a;
+    x86::label loop(a);
+
+    // Loop heads are padded with multi-byte NOPs up to the requested alignment.
+    a.align_loops(16);
+    a(x86::XOR(x86::RAX, x86::RAX));
+    a(loop);
+    a(x86::ADD(x86::RAX, Y));
+    a(x86::SUB(X, 1));
+    a(x86::JNZ(loop));
+    a(x86::RET());
+
+    auto m = a.assemble_function<std::int64_t(std::int64_t, std::int64_t)>();
+    ASSERT_EQ(0x66, m.text()[3]);
+    ASSERT_EQ(0x0f, m.text()[12]);
+    ASSERT_EQ(0x48, m.text()[16]);
+    ASSERT_EQ(42, m.link()(6, 7));
+
+    // Nothing is padded when that would take more than max_skip bytes.
+    a.clear();
+    a(x86::MOV(x86::RAX, X));
+    a.align(16, 4);
+    a(x86::RET());
+    ASSERT_EQ(4, a.assemble_function<std::int64_t(std::int64_t)>().text().size());
+
+    // Data is padded with zeros.
+    a.clear();
+    x86::global var;
+    a(x86::MOV(x86::RAX, x86::DS[var]));
+    a(x86::RET());
+    a.data();
+    a(x86::DB(1));
+    a.align(8);
+    a(var);
+    a(x86::DQ(123456));
+
+    auto d = a.assemble_function<std::int64_t()>();
+    ASSERT_EQ(16, d.data().size());
+    ASSERT_EQ(123456, d.link()());
 }
 
 TEST(X86Asm, MulDiv)
@@ -388,3 +563,95 @@ TEST(X86Asm, Data)
 
     ASSERT_EQ(123456, a.assemble_function<std::int64_t()>().link()());
 }
+
+TEST(X86Asm, SSE)
+{
+    // Floating point arguments and return values are in XMM0, XMM1, ...
+    x86::assembler a;
+    a(x86::MOVAPS(x86::XMM9, x86::XMM0));
+    a(x86::MULSD(x86::XMM9, x86::XMM1));
+    a(x86::SUBSD(x86::XMM9, x86::XMM0));
+    a(x86::MOVAPS(x86::XMM0, x86::XMM9));
+    a(x86::RET());
+    ASSERT_EQ(2.5 * 4 - 2.5, (a.assemble_function<double(double, double)>().link()(2.5, 4)));
+
+    a.clear();
+    a(x86::MOVSS(x86::XMM12, x86::DS[X]));
+    a(x86::DIVSS(x86::XMM12, x86::DS[Y]));
+    a(x86::MOVSS(x86::DS[X], x86::XMM12));
+    a(x86::RET());
+    float x = 3, y = 4;
+    a.assemble_function<void(float *, float *)>().link()(&x, &y);
+    ASSERT_EQ(0.75f, x);
+
+    // Conversions truncate towards zero, like in C
+    a.clear();
+    a(x86::CVTSS2SD(x86::XMM1, x86::XMM0));
+    a(x86::CVTSI2SD(x86::XMM0, X));
+    a(x86::ADDSD(x86::XMM0, x86::XMM1));
+    a(x86::CVTTSD2SI(x86::R10, x86::XMM0));
+    a(x86::MOV(x86::RAX, x86::R10));
+    a(x86::RET());
+    ASSERT_EQ(-7, (a.assemble_function<std::int64_t(std::int64_t, float)>().link()(-5, -2.75f)));
+
+    // Unordered compares set the flags like unsigned integer ones
+    a.clear();
+    a(x86::UCOMISD(x86::XMM0, x86::XMM1));
+    a(x86::SETA(x86::AL));
+    a(x86::RET());
+    auto gt = a.assemble_function<bool(double, double)>().link();
+    ASSERT_TRUE(gt(2, 1));
+    ASSERT_FALSE(gt(1, 2));
+    ASSERT_FALSE(gt(1, 1));
+
+    a.clear();
+    a(x86::MOVQ(x86::XMM14, X));
+    a(x86::MOVQ(x86::RAX, x86::XMM14));
+    a(x86::RET());
+    ASSERT_EQ(0x123456789abcdef, a.assemble_function<std::int64_t(std::int64_t)>().link()(0x123456789abcdef));
+
+    // Packed integer arithmetic
+    a.clear();
+    a(x86::MOVUPS(x86::XMM8, x86::DS[X]));
+    a(x86::MOVUPS(x86::XMM1, x86::DS[Y]));
+    a(x86::PSUBD(x86::XMM8, x86::XMM1));
+    a(x86::MOVUPS(x86::DS[X], x86::XMM8));
+    a(x86::RET());
+    std::int32_t u[] = { 10, 20, 30, 40 }, v[] = { 1, 2, 3, 4 };
+    a.assemble_function<void(std::int32_t *, std::int32_t *)>().link()(u, v);
+    ASSERT_EQ(9, u[0]);
+    ASSERT_EQ(36, u[3]);
+}
+
+TEST(X86Asm, AVX)
+{
+    if (!x86::features::host()._avx) return;
+
+    // Three operands, and the second source can be in memory
+    x86::assembler a;
+    a(x86::MOV(x86::R9, Y));
+    a(x86::VMOVUPS(x86::YMM8, x86::DS[X]));
+    a(x86::VADDPS(x86::YMM1, x86::YMM8, x86::DS[x86::R9]));
+    a(x86::VMULPS(x86::YMM10, x86::YMM1, x86::YMM8));
+    a(x86::VMOVUPS(x86::DS[X], x86::YMM10));
+    a(x86::VZEROUPPER());
+    a(x86::RET());
+    float x[] = { 1, 2, 3, 4, 5, 6, 7, 8 }, y[] = { 1, 1, 1, 1, 2, 2, 2, 2 };
+    a.assemble_function<void(float *, float *)>().link()(x, y);
+    ASSERT_EQ(2, x[0]);
+    ASSERT_EQ(20, x[3]);
+    ASSERT_EQ(35, x[4]);
+    ASSERT_EQ(80, x[7]);
+
+    if (!x86::features::host()._avx2) return;
+    a.clear();
+    a(x86::VMOVUPS(x86::YMM0, x86::DS[X]));
+    a(x86::VPADDQ(x86::YMM0, x86::YMM0, x86::DS[Y]));
+    a(x86::VMOVUPS(x86::DS[X], x86::YMM0));
+    a(x86::VZEROUPPER());
+    a(x86::RET());
+    std::int64_t u[] = { 1, 2, 3, 4 }, v[] = { 10, 20, 30, 40 };
+    a.assemble_function<void(std::int64_t *, std::int64_t *)>().link()(u, v);
+    ASSERT_EQ(11, u[0]);
+    ASSERT_EQ(44, u[3]);
+}
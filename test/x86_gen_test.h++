@@ -202,3 +202,35 @@ TEST(X86Gen, Branch)
     ASSERT_FALSE(test_irbranch<ir::Gt>(13, 13));
     ASSERT_TRUE(test_irbranch<ir::Gte>(13, 13));
 }
+
+// A function with spill slots for the given number of words, which calls a function that returns
+// RSP modulo 16 on entry, which is 8 when the call was made with the stack aligned.
+std::int64_t test_frame_alignment(int words)
+{
+    ir::code code;
+
+    auto i64 = code(ir::Int(-64));
+    std::vector<ir::word> args = { code(ir::Fun(0, i64)) };
+    for (int i = 0; i < words; ++i) args.push_back(i64);
+    auto fun = code(ir::node_id::Enter, args.data(), args.size());
+    code(ir::Exit(fun));
+
+    x86::function_gen<std::int64_t()> gen;
+    auto &a = gen.assembly();
+    x86::label check(a);
+    ir::word pos = 0;
+    while (pos <= fun) code.pass(gen, pos);
+    a(x86::CALL(check));
+    while (pos < code.size()) code.pass(gen, pos);
+    a(check);
+    a(x86::MOV(x86::RAX, x86::RSP));
+    a(x86::AND(x86::RAX, 15));
+    a(x86::RET());
+
+    return gen.fun()();
+}
+
+TEST(X86Gen, FrameAlignment)
+{
+    for (int words = 1; words <= 4; ++words) ASSERT_EQ(8, test_frame_alignment(words));
+}
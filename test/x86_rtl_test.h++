@@ -32,3 +32,100 @@ TEST(X86RTL, Basic)
     // tweaked to preserve rbx, the only callee saved register that would otherwise be allocated.
 //    ASSERT_EQ(42, gen.fun()(4, -14));
 }
+
+TEST(X86RTL, LinearRA)
+{
+    // The same code as above, through the linear scan allocator, which does save the callee saved
+    // registers it uses, so this one can be run.
+    std::string codetext =
+        "[ fun: Enter [ Fun 0 [ Int -64 ] [ Int -64 ] [ Int -64] ] ]"
+        "[ x: Temp [ Int -64 ] ]"
+        "[ y: Temp [ Int -64 ] ]";
+
+    codetext = codetext +
+        "[ Move [ Reg x " + std::to_string(ir::x86::id(X)) + " ] [ Arg fun 0 ] ]" +
+        "[ Move [ Reg y " + std::to_string(ir::x86::id(Y)) + " ] [ Arg fun 1 ] ]" +
+        "[ r: Reg [ RVal fun ] " + std::to_string(ir::x86::id(x86::RAX)) + " ]"
+        "[ a: Add x y ]"
+        "[ b: Mul x [ 13 ] ]"
+        "[ Move r [ Add a b ] ]"
+        "[ Exit fun ]";
+
+    ir::code code = textual(codetext).code();
+    ir::code rtl = x86::rtl<ir::code, 64>(code);
+
+    ir::code final;
+
+    linear_ra<x86::regs64>().process(final, rtl);
+
+    x86::function_gen<std::int64_t(std::int64_t, std::int64_t)> gen;
+    final.pass(gen);
+
+    ASSERT_EQ(42, gen.fun()(4, -14));
+}
+
+TEST(X86RTL, BranchOperands)
+{
+    // The loop pass leaves arithmetic in branch conditions, whose operands need registers
+    std::string codetext =
+        "[ i64: Int -64 ]"
+        "[ fun: Enter [ Fun 0 i64 i64 i64 ] ]"
+        "[ t: Temp i64 ]"
+        "[ Move t [ Arg fun 0 ] ]"
+        "[ x: SkipIf [ Lt [ And t [ Arg fun 1 ] ] [ Sub [ Arg fun 1 ] t ] ] ]"
+        "[ Move t [ Add t [ Arg fun 1 ] ] ]"
+        "[ Here x ]"
+        "[ Move [ RVal fun ] t ]"
+        "[ Exit fun ]";
+
+    ir::code code = control::unstructurized<ir::code>(textual(codetext).code());
+    auto f = build<std::int64_t(std::int64_t, std::int64_t)>(code);
+    ASSERT_EQ(13, f(6, 7));
+    ASSERT_EQ(1, f(1, 7));
+}
+
+TEST(X86RTL, MulRegisters)
+{
+    // Induction variable products are Muls of two Temps, or of a Temp and a constant either way
+    std::string codetext =
+        "[ i64: Int -64 ]"
+        "[ fun: Enter [ Fun 0 i64 i64 i64 ] ]"
+        "[ Move [ RVal fun ] [ Add [ Mul [ Arg fun 0 ] [ Arg fun 1 ] ]"
+        "    [ Add [ Mul [ Arg fun 0 ] [ Cast i64 [ 100 ] ] ] [ Mul [ Cast i64 [ 1000 ] ] [ Arg fun 1 ] ] ] ] ]"
+        "[ Exit fun ]";
+
+    ir::code code = control::unstructurized<ir::code>(textual(codetext).code());
+    auto f = build<std::int64_t(std::int64_t, std::int64_t)>(code);
+    ASSERT_EQ(42 + 600 + 7000, f(6, 7));
+    ASSERT_EQ(-42 - 600 + 7000, f(-6, 7));
+}
+
+TEST(X86RTL, Constants)
+{
+    // Simplify leaves constants as Casts of Imms, which are truncated to their type
+    auto constant = [](const std::string &type, const std::string &value)
+    {
+        return control::unstructurized<ir::code>(textual("[ t: " + type + " ] [ fun: Enter [ Fun 0 t ] ]"
+            "[ Move [ RVal fun ] [ Cast t [ " + value + " ] ] ] [ Exit fun ]").code());
+    };
+
+    auto a = constant("Int -64", "-3"), b = constant("Int -32", "4294967295"), c = constant("Int -8", "200");
+    ASSERT_EQ(-3, build<std::int64_t()>(a)());
+    ASSERT_EQ(-1, build<std::int32_t()>(b)());
+    ASSERT_EQ(-56, build<std::int8_t()>(c)());
+}
+
+TEST(X86RTL, Reuse)
+{
+    // Writing into buffers used before gives the same code as fresh ones, so a compiler can keep
+    // them from one function to the next
+    ir::code out, rewritten;
+    for (int w : { 4, 2, 8 })
+    {
+        ir::code code = sample_chain(5, w);
+        x86::rtl<ir::code, 64>(code, out, rewritten);
+        ir::code fresh = x86::rtl<ir::code, 64>(code);
+        ASSERT_EQ(fresh.bytes(), out.bytes()) << w;
+        ASSERT_EQ(fresh.nodes().count(), out.nodes().count()) << w;
+    }
+}
@@ -17,9 +17,19 @@
 */
 
 #include "ir.h++"
+#include "program.h++"
 
+#include <cstring>
+#include <functional>
+#include <fstream>
+#include <limits>
 #include <unordered_map>
 
+#ifdef CODEGEN_USE_MMAP
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
 namespace codegen
 {
     class textual
@@ -81,8 +91,7 @@ namespace codegen
                 unsigned c = 0;
                 if (*it == '\\')
                     if (++it == end) throw syntax_error<IT> { it };
-                    else if (*it == '"') node[node.nargs()] = '"';
-                    else if (*it == '\\') node[node.nargs()] = '\\';
+                    else if (*it == '"' || *it == '\\') node[node.nargs()] = *it++;
                     else
                     {
                         while (it != end && *it >= '0' && *it <= '7') c = (c << 3) | (*it++ - '0');
@@ -185,4 +194,389 @@ namespace codegen
         ir::code code = textual(text).code();
         return code;
     }
+
+    // Names interned in one buffer of characters, numbered in the order they are added. The names
+    // are found through an open addressing hash table of their numbers, so a lookup takes the
+    // characters where they are, in the input of a parser, and allocates nothing.
+    class symbol_table
+    {
+        struct symbol
+        {
+            std::uint64_t _hash;
+            std::uint32_t _offset, _length;
+        };
+
+        std::vector<char> _chars;
+        std::vector<symbol> _symbols;
+        std::vector<std::uint32_t> _slots; // symbol number + 1, 0 for an empty slot
+
+        // FNV-1a
+        static std::uint64_t hash(const char *p, std::size_t n)
+        {
+            std::uint64_t h = 0xcbf29ce484222325;
+            for (std::size_t i = 0; i < n; ++i) h = (h ^ (byte)p[i]) * 0x100000001b3;
+            return h;
+        }
+
+        // The slot of the name, or the empty slot where it would go
+        std::size_t slot(std::uint64_t h, const char *p, std::size_t n) const
+        {
+            std::size_t mask = _slots.size() - 1, i = h & mask;
+            for (; _slots[i]; i = (i + 1) & mask)
+            {
+                auto &s = _symbols[_slots[i] - 1];
+                if (s._hash == h && s._length == n && !std::memcmp(_chars.data() + s._offset, p, n)) break;
+            }
+            return i;
+        }
+
+        void grow()
+        {
+            _slots.assign(_slots.empty()? 64 : _slots.size() * 2, 0);
+            for (std::uint32_t k = 0; k < _symbols.size(); ++k)
+            {
+                std::size_t mask = _slots.size() - 1, i = _symbols[k]._hash & mask;
+                while (_slots[i]) i = (i + 1) & mask;
+                _slots[i] = k + 1;
+            }
+        }
+
+    public:
+
+        static constexpr std::uint32_t none = ~std::uint32_t(0);
+
+        std::uint32_t find(const char *p, std::size_t n) const
+        {
+            if (_symbols.empty()) return none;
+            return _slots[slot(hash(p, n), p, n)] - 1;
+        }
+
+        std::uint32_t intern(const char *p, std::size_t n)
+        {
+            if (2 * (_symbols.size() + 1) > _slots.size()) grow();
+            auto h = hash(p, n);
+            auto i = slot(h, p, n);
+            if (!_slots[i])
+            {
+                _symbols.push_back(symbol { h, (std::uint32_t)_chars.size(), (std::uint32_t)n });
+                _chars.insert(_chars.end(), p, p + n);
+                _slots[i] = _symbols.size();
+            }
+            return _slots[i] - 1;
+        }
+
+        std::size_t size() const
+        {
+            return _symbols.size();
+        }
+
+        // Forgets the names, but keeps the memory for the next ones
+        void clear()
+        {
+            _chars.clear();
+            _symbols.clear();
+            std::fill(_slots.begin(), _slots.end(), 0);
+        }
+    };
+
+    // A parser for the same textual form as textual above, for big inputs. It reads from memory,
+    // a mapped file, or a stream in chunks, and writes the nodes straight into the code given to
+    // it. Tokens are looked at where they are in the input, symbols are interned, and the
+    // arguments of the nodes being read are kept on one stack, so apart from the code growing,
+    // parsing allocates nothing once the buffers of the parser have grown to size. The parser can
+    // be used again for the next input, each with symbols of its own. Errors are those of textual,
+    // with offsets in the input as positions.
+    class textual_stream
+    {
+        static constexpr int eof = -0x100;
+
+        // The input is either all in memory, or read in chunks into the buffer. The characters
+        // from _mark on are kept when the buffer is refilled, so the token being read stays in
+        // one piece.
+        const char *_it = nullptr, *_end = nullptr, *_mark = nullptr, *_base = nullptr;
+        std::size_t _offset = 0;
+        std::vector<char> _buf;
+        std::function<std::size_t(char *, std::size_t)> _read;
+
+        symbol_table _symbols;
+        std::vector<ir::word> _values; // of the symbols, -1 for the labels of unfinished blocks
+        std::vector<std::uint32_t> _labels;
+        std::vector<ir::word> _args;
+
+        using syntax_error = textual::syntax_error<std::size_t>;
+        using undefined_symbol = textual::undefined_symbol<std::size_t>;
+
+        // The names of the nodes, numbered by node id
+        static const symbol_table &node_names()
+        {
+            static const symbol_table names = []
+            {
+                symbol_table t;
+#               define X(base,name,...) t.intern(#name, sizeof #name - 1);
+#               include "ir_nodes.def"
+                return t;
+            }();
+            return names;
+        }
+
+        std::size_t offset() const
+        {
+            return _offset + (_it - _base);
+        }
+
+        bool fill()
+        {
+            if (!_read) return false;
+            std::size_t keep = _end - _mark;
+            _offset += _mark - _base;
+            if (keep) std::memmove(_buf.data(), _mark, keep);
+            if (keep == _buf.size()) _buf.resize(2 * _buf.size());
+            std::size_t n = _read(_buf.data() + keep, _buf.size() - keep);
+            _base = _mark = _buf.data();
+            _it = _base + keep;
+            _end = _it + n;
+            if (!n) _read = nullptr;
+            return n;
+        }
+
+        int peek()
+        {
+            if (_it == _end && !fill()) return eof;
+            return *_it;
+        }
+
+        void skip_whitespace()
+        {
+            for (int c;;)
+            {
+                while ((c = peek()) != eof && c <= ' ') ++_it;
+                if (c != '#') break;
+                while ((c = peek()) != eof && c != '\r' && c != '\n') ++_it;
+            }
+        }
+
+        // Reads a symbol or a number, which starts at _mark
+        std::size_t token()
+        {
+            _mark = _it;
+            for (int c; (c = peek()) > ' ' && c != ']' && c != '[' && c != ':' && c != '"' && c != '#'; ) ++_it;
+            return _it - _mark;
+        }
+
+        // Reads a number, which must have digits and fit in 64 bits
+        std::int_least64_t number(const char *p, std::size_t n)
+        {
+            std::size_t k = 0;
+            bool negative = p[0] == '-' && ++k;
+            if (k == n) throw syntax_error { offset() };
+            std::uint64_t limit = (std::uint64_t)std::numeric_limits<std::int_least64_t>::max() + negative, x = 0;
+            while (k < n)
+            {
+                unsigned d = p[k++] - '0';
+                if (d > 9 || x > (limit - d) / 10) throw syntax_error { offset() };
+                x = x * 10 + d;
+            }
+            return negative? (std::int_least64_t)(0 - x) : (std::int_least64_t)x;
+        }
+
+        void string(ir::code &code)
+        {
+            std::size_t start = offset(), base = _args.size();
+            ++_it;
+            for (int c;;)
+            {
+                _mark = _it;
+                if ((c = peek()) == eof) throw syntax_error { start };
+                if (c == '"') break;
+                ++_it;
+                if (c == '\\')
+                {
+                    if ((c = peek()) == eof) throw syntax_error { offset() };
+                    else if (c == '"' || c == '\\') ++_it;
+                    else
+                    {
+                        unsigned x = 0;
+                        for (; (c = peek()) >= '0' && c <= '7'; ++_it) x = (x << 3) | (c - '0');
+                        if (c != '\\') throw syntax_error { offset() };
+                        ++_it;
+                        c = (char)x;
+                    }
+                }
+                _args.push_back(c);
+            }
+            ++_it;
+            code(ir::node_id::Str, _args.data() + base, _args.size() - base);
+            _args.resize(base);
+        }
+
+        ir::word node(ir::code &code, ir::word id)
+        {
+            std::size_t base = _args.size();
+            for (int c; (c = peek()) != eof && c != ']'; skip_whitespace())
+                if (c == '"')
+                {
+                    _args.push_back(code.size());
+                    string(code);
+                }
+                else if (c == '-' || (c >= '0' && c <= '9'))
+                {
+                    auto n = token();
+                    _args.push_back(number(_mark, n));
+                }
+                else if (c == '[')
+                {
+                    ++_it;
+                    _args.push_back(block(code));
+                }
+                else
+                {
+                    std::size_t start = offset(), n = token();
+                    auto sym = _symbols.find(_mark, n);
+                    if (sym == symbol_table::none || _values[sym] == -1) throw undefined_symbol { std::string(_mark, n), start };
+                    _args.push_back(_values[sym]);
+                }
+            ir::word nargs = _args.size() - base;
+            if (nargs < ir::node_index::min_nargs(id) || (nargs > ir::node_index::min_nargs(id) && !ir::node_index::is_variadic(id)))
+                throw syntax_error { offset() };
+            auto pos = code(id, _args.data() + base, nargs);
+            _args.resize(base);
+            return pos;
+        }
+
+        ir::word block(ir::code &code)
+        {
+            std::size_t start = offset(), labels = _labels.size(), n;
+            for (;;)
+            {
+                skip_whitespace();
+                n = token();
+                skip_whitespace();
+                if (peek() != ':') break;
+                _labels.push_back(_symbols.intern(_mark, n));
+                if (_values.size() < _symbols.size()) _values.push_back(-1);
+                ++_it;
+            }
+            ir::word pos;
+            if (n && (*_mark == '-' || (*_mark >= '0' && *_mark <= '9'))) pos = code(ir::Imm(number(_mark, n)));
+            else
+            {
+                auto id = node_names().find(_mark, n);
+                if (id == symbol_table::none) throw syntax_error { start };
+                pos = node(code, id);
+            }
+            if (peek() != ']') throw syntax_error { offset() };
+            ++_it;
+            for (std::size_t k = labels; k < _labels.size(); ++k) _values[_labels[k]] = pos;
+            _labels.resize(labels);
+            return pos;
+        }
+
+        void parse(ir::code &code)
+        {
+            _symbols.clear();
+            _values.clear();
+            _labels.clear();
+            _args.clear();
+            for (;;)
+            {
+                _mark = _it;
+                skip_whitespace();
+                if (peek() != '[') break;
+                ++_it;
+                block(code);
+            }
+            if (peek() != eof) throw syntax_error { offset() };
+        }
+
+    public:
+
+        struct file_error
+        {
+            std::string _path;
+        };
+
+        // Thrown for a chunk size of 0, with which nothing could ever be read
+        struct chunk_error
+        {
+        };
+
+        // Parses the characters from begin to end, which stay where they are
+        void parse(ir::code &code, const char *begin, const char *end)
+        {
+            _read = nullptr;
+            _it = _mark = _base = begin;
+            _end = end;
+            _offset = 0;
+            parse(code);
+        }
+
+        void parse(ir::code &code, const std::string &text)
+        {
+            parse(code, text.data(), text.data() + text.size());
+        }
+
+        // Parses what read gives, chunk bytes at a time. read(p, n) stores at most n characters at
+        // p and returns how many it stored, 0 at the end of the input.
+        void parse(ir::code &code, const std::function<std::size_t(char *, std::size_t)> &read, std::size_t chunk = 1 << 16)
+        {
+            if (!chunk) throw chunk_error { };
+            if (_buf.size() < chunk) _buf.resize(chunk);
+            _read = read;
+            _it = _end = _mark = _base = _buf.data();
+            _offset = 0;
+            parse(code);
+            _read = nullptr;
+        }
+
+        void parse(ir::code &code, std::istream &in, std::size_t chunk = 1 << 16)
+        {
+            parse(code, [&](char *p, std::size_t n) -> std::size_t
+            {
+                in.read(p, n);
+                return in.gcount();
+            }, chunk);
+        }
+
+        // Maps the file in memory where the platform can, and reads it in chunks otherwise
+        void parse_file(ir::code &code, const std::string &path)
+        {
+
+#       ifdef CODEGEN_USE_MMAP
+
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd == -1) throw file_error { path };
+            struct stat st;
+            if (fstat(fd, &st) == -1)
+            {
+                close(fd);
+                throw file_error { path };
+            }
+            std::size_t size = st.st_size;
+            void *p = size? mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+            close(fd);
+            if (p == MAP_FAILED) throw file_error { path };
+            if (size) madvise(p, size, MADV_SEQUENTIAL);
+
+            struct mapping
+            {
+                void *_p;
+                std::size_t _size;
+
+                ~mapping()
+                {
+                    if (_size) munmap(_p, _size);
+                }
+            } m { p, size };
+            parse(code, (const char *)p, (const char *)p + size);
+
+#       else
+
+            std::ifstream in(path, std::ios::binary);
+            if (!in) throw file_error { path };
+            parse(code, in);
+
+#       endif
+
+        }
+    };
 }
@@ -19,6 +19,8 @@
 #ifndef CODEGEN_X86_ASM_H
 #define CODEGEN_X86_ASM_H
 
+#include <cpuid.h>
+
 #include "module.h++"
 
 namespace codegen
@@ -65,6 +67,39 @@ namespace codegen
             }
         };
 
+        // The instruction set extensions of the processor that the code generator can choose from.
+        // SSE2 is a part of x86-64, so it is always there. AVX also needs the operating system to
+        // save the upper halves of the YMM registers, which XGETBV tells.
+        struct features
+        {
+            bool _avx = false;
+            bool _avx2 = false;
+
+            // The features of the processor we are running on, looked up once
+            static features host()
+            {
+                static const features f = detect();
+                return f;
+            }
+
+        private:
+
+            static features detect()
+            {
+                features f;
+                unsigned a, b, c, d;
+                if (!__get_cpuid(1, &a, &b, &c, &d)) return f;
+                if ((c & 1 << 27) && (c & 1 << 28))
+                {
+                    unsigned lo, hi;
+                    asm volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+                    f._avx = (lo & 6) == 6;
+                }
+                if (f._avx && __get_cpuid_count(7, 0, &a, &b, &c, &d)) f._avx2 = b & 1 << 5;
+                return f;
+            }
+        };
+
         struct operand
         {
         };
@@ -81,12 +116,12 @@ namespace codegen
 
             constexpr reg(const reg &r) : _b(r._b), _i(r._i) { }
 
-            byte log2bits() const
+            constexpr byte log2bits() const
             {
                 return _b;
             }
 
-            byte index() const
+            constexpr byte index() const
             {
                 return _i;
             }
@@ -193,6 +228,16 @@ namespace codegen
         {
         };
 
+        // A branch to a label that was never marked
+        struct unmarked_label : exception
+        {
+        };
+
+        // A short branch whose target is out of its reach, which relaxation should never leave
+        struct branch_out_of_range : exception
+        {
+        };
+
         class assembler;
 
         struct symbol : operand
@@ -301,8 +346,8 @@ namespace codegen
             void add(int section, std::size_t index, symbol *sym, bool relative, byte nbytes)
             {
                 auto id = sym->id();
-                auto symit = _symbols.lower_bound(index);
-                if (symit->first != id) _symbols.insert(--symit, std::pair<std::intptr_t, symbol *>(id, sym));
+                auto symit = _symbols.lower_bound(id);
+                if (symit == _symbols.end() || symit->first != id) _symbols.insert(symit, std::pair<std::intptr_t, symbol *>(id, sym->clone()));
                 _entries[section].push_back(entry { index, id, relative, nbytes });
             }
         };
@@ -430,6 +475,7 @@ namespace codegen
                 if (_displacement) delete _displacement;
                 if (other._displacement) _displacement = other._displacement->clone();
                 else _displacement = nullptr;
+                return *this;
             }
 
             reg_mem &operator=(reg_mem &&other)
@@ -438,6 +484,7 @@ namespace codegen
                 if (_displacement) delete _displacement;
                 _displacement = other._displacement;
                 other._displacement = nullptr;
+                return *this;
             }
 
             bool is_indirect() const
@@ -520,6 +567,11 @@ namespace codegen
             {
                 return _index;
             }
+
+            byte base_index() const
+            {
+                return _base;
+            }
         };
 
         class reg_imm : public operand
@@ -699,8 +751,30 @@ namespace codegen
         static constexpr sse_reg XMM14(14);
         static constexpr sse_reg XMM15(15);
 
+        using avx_reg = simd_reg<8>;
+
+        static constexpr avx_reg YMM0(0);
+        static constexpr avx_reg YMM1(1);
+        static constexpr avx_reg YMM2(2);
+        static constexpr avx_reg YMM3(3);
+        static constexpr avx_reg YMM4(4);
+        static constexpr avx_reg YMM5(5);
+        static constexpr avx_reg YMM6(6);
+        static constexpr avx_reg YMM7(7);
+
+        static constexpr avx_reg YMM8(8);
+        static constexpr avx_reg YMM9(9);
+        static constexpr avx_reg YMM10(10);
+        static constexpr avx_reg YMM11(11);
+        static constexpr avx_reg YMM12(12);
+        static constexpr avx_reg YMM13(13);
+        static constexpr avx_reg YMM14(14);
+        static constexpr avx_reg YMM15(15);
+
         struct instruction
         {
+            virtual ~instruction() { }
+
             virtual instruction *clone() const = 0;
 
             virtual void encode(std::vector<byte> &code, int section, reloc *rel, const model &m) const = 0;
@@ -712,6 +786,17 @@ namespace codegen
                 encode(temp, 0, nullptr, m);
                 return temp.size();
             }
+
+            // Branches to labels come in a short form with an 8 bit displacement and a near form with
+            // a 32 bit one. The assembler starts out with the short form and calls relax when the
+            // target turns out to be out of its reach; these two are only of interest to branches.
+
+            virtual bool branch_target(std::size_t &) const
+            {
+                return false;
+            }
+
+            virtual void relax() { }
         };
 
         template<unsigned N, byte... C> class basic_instruction : public instruction
@@ -751,6 +836,8 @@ namespace codegen
 
         using RET = basic_instruction<1, 0xc3>;
 
+        using NOP = basic_instruction<1, 0x90>;
+
         using CLC = basic_instruction<1, 0xf8>;
         using CLI = basic_instruction<1, 0xfa>;
         using CLD = basic_instruction<1, 0xfc>;
@@ -865,10 +952,10 @@ namespace codegen
 
                     if (immbytes > 1 << _reg_mem.log2bits() - 3)
                         throw argument_mismatch("Immediate wider than the operation itself");
-                    if (!IS_MOV && !_reg_mem.is_indirect() && !_reg_mem.reg_index() && (_reg_mem.log2bits() < 5 || immbytes > 1)) // the shorter encodings for xAX
+                    if (!IS_MOV && !_reg_mem.is_indirect() && !_reg_mem.base_index() && (_reg_mem.log2bits() < 5 || immbytes > 1)) // the shorter encodings for xAX
                     {
-                        code.push_back(_opcode | 4 | (_reg_mem.log2bits() == 3? 1 : 0));
-                        immbytes = 1 << _reg_mem.log2bits() - 3;
+                        code.push_back(_opcode | 4 | (_reg_mem.log2bits() == 3? 0 : 1));
+                        immbytes = _reg_mem.log2bits() == 6? 4 : 1 << (_reg_mem.log2bits() - 3);
                     }
                     else if (IS_MOV)
                     {
@@ -894,7 +981,7 @@ namespace codegen
                         else if (immbytes > 1)
                         {
                             code.push_back(0x81);
-                            immbytes = 1 << _reg_mem.log2bits() - 3;
+                            immbytes = _reg_mem.log2bits() == 6? 4 : 1 << (_reg_mem.log2bits() - 3);
                         }
                         else
                         {
@@ -962,6 +1049,12 @@ namespace codegen
 
         class assembler
         {
+            struct alignment
+            {
+                std::size_t _boundary;
+                std::size_t _max_skip;
+            };
+
             struct section
             {
                 // only relevant to code, but here, for now, to avoid need for two versions of compute_global_addresses
@@ -971,31 +1064,75 @@ namespace codegen
 
                 std::map<std::size_t, std::intptr_t> _globals;
 
+                // The alignment requested before the instruction at each index, and the address of
+                // each instruction (and of the end of the section) as laid out by layout.
+                std::map<std::size_t, alignment> _alignment;
+                std::vector<std::size_t> _addr;
+
                 virtual void clear()
                 {
                     for (auto i : _code) delete i;
                     _code.clear();
                     _globals.clear();
+                    _alignment.clear();
+                    _addr.clear();
 
                     _model.clear();
                     _model[0] = model();
                 }
 
+                static std::size_t padding(std::size_t addr, const alignment &a)
+                {
+                    std::size_t pad = (-addr) & (a._boundary - 1);
+                    return pad <= a._max_skip? pad : 0;
+                }
+
+                const model &model_at(std::size_t i) const
+                {
+                    return (--_model.upper_bound(i))->second;
+                }
+
+                std::vector<std::size_t> lengths() const
+                {
+                    std::vector<std::size_t> length;
+                    length.reserve(_code.size());
+                    auto nm = _model.begin(), m = nm++;
+                    for (std::size_t i = 0; i < _code.size(); ++i)
+                    {
+                        if (nm != _model.end() && nm->first <= i) m = nm++;
+                        length.push_back(_code[i]->length(m->second));
+                    }
+                    return length;
+                }
+
+                void layout(const std::vector<std::size_t> &length)
+                {
+                    _addr.resize(_code.size() + 1);
+                    auto align = _alignment.begin();
+                    std::size_t addr = 0;
+                    for (std::size_t i = 0; i <= _code.size(); ++i)
+                    {
+                        if (align != _alignment.end() && align->first == i) addr += padding(addr, align++->second);
+                        _addr[i] = addr;
+                        if (i < _code.size()) addr += length[i];
+                    }
+                }
+
                 void compute_global_addresses(std::map<std::intptr_t, std::size_t> &addr)
                 {
-                    auto sym = _globals.begin();
-                    for (std::size_t i = 0, pos = 0; i < _code.size() && sym != _globals.end(); ++i)
+                    for (auto sym : _globals) addr[sym.second] = _addr[sym.first];
+                }
+
+                template<class PAD> void encode(std::vector<byte> &code, int section, reloc *rel, PAD pad)
+                {
+                    auto nm = _model.begin(), m = nm++;
+                    for (std::size_t i = 0; i < _code.size(); ++i)
                     {
-                        auto nm = _model.begin(), m = nm++;
                         if (nm != _model.end() && nm->first <= i) m = nm++;
-                        // TODO: align here
-                        if (sym->first == i)
-                        {
-                            addr[sym->second] = pos;
-                            ++sym;
-                        }
-                        pos += _code[i]->length(m->second);
+                        pad(code, _addr[i] - code.size());
+                        _code[i]->encode(code, section, rel, m->second);
                     }
+                    pad(code, _addr[_code.size()] - code.size());
                 }
             }
             _data, _bss;
@@ -1005,33 +1142,151 @@ namespace codegen
                 std::map<std::size_t, std::size_t> _label2pos;
                 std::map<std::size_t, std::size_t> _pos2label;
 
+                alignment _loop_alignment = { 1, 0 };
+
                 void clear()
                 {
                     section::clear();
 
                     _pos2label.clear();
                     _label2pos.clear();
-            }
+                }
 
                 std::map<std::size_t, std::size_t> _label2addr;
-
+                std::size_t _relaxation_rounds = 0;
+
+                // Lays out the code using the short form of every branch whose target is within its
+                // reach. All branches start out short, and each round relaxes the ones that cannot
+                // reach their targets. That moves code around, so the next round looks at the short
+                // branches spanning an instruction or a padding that changed size, and only those.
+                // The addresses are kept in a Fenwick tree of the instruction sizes, and the branches
+                // in a tree of their spans, so a round takes time in proportion to what changed in
+                // it, not to the size of the function. Branches never go back to the short form, so
+                // this ends after at most one round per branch, but usually after one or two.
                 void compute_label_addresses()
                 {
-                    // TODO: there are certainly more efficient ways to do this
-                    std::size_t prev = 1, total;
-                    _label2addr.clear();
-                    for (total = 0; total != prev; prev = total)
+                    struct branch
                     {
-                        auto label = _pos2label.begin();
-                        auto nm = _model.begin(), m = nm++;
-                        for (std::size_t i = 0; i < _code.size() && label != _pos2label.end(); ++i)
+                        std::size_t _pos;
+                        std::size_t _target;
+                        std::size_t _from, _to; // what changes the displacement, alignments included
+                        bool _short;
+                    };
+
+                    std::vector<branch> branches;
+                    for (std::size_t i = 0, label; i < _code.size(); ++i)
+                        if (_code[i]->branch_target(label))
                         {
-                            if (nm != _model.end() && nm->first <= i) m = nm++;
-                            // TODO: align here
-                            if (i == label->first) _label2addr[label++->second] = total;
-                            total += _code[i]->length(m->second);
+                            auto t = _label2pos.find(label);
+                            if (t == _label2pos.end()) throw unmarked_label();
+                            branches.push_back(branch { i, t->second, std::min(i, t->second), std::max(i + 1, t->second), true });
                         }
+
+                    if (_loop_alignment._boundary > 1)
+                        for (auto &b : branches)
+                            if (b._target <= b._pos && !_alignment.count(b._target)) _alignment[b._target] = _loop_alignment;
+
+                    auto length = lengths();
+                    layout(length);
+
+                    // size[i] is the distance from instruction i to instruction i + 1, which is
+                    // its length and the padding before the next one.
+                    std::size_t n = _code.size();
+                    std::vector<std::int64_t> size(n + 1, 0);
+                    for (std::size_t i = 1; i <= n; ++i)
+                    {
+                        size[i] += _addr[i] - _addr[i - 1];
+                        std::size_t up = i + (i & -i);
+                        if (up <= n) size[up] += size[i];
                     }
+                    auto grow = [&](std::size_t i, std::int64_t d) { for (++i; i <= n; i += i & -i) size[i] += d; };
+                    auto addr = [&](std::size_t i) { std::int64_t a = 0; for (; i; i -= i & -i) a += size[i]; return a; };
+                    std::map<std::size_t, std::size_t> pad;
+                    for (auto &a : _alignment) if (a.first) pad[a.first] = _addr[a.first] - _addr[a.first - 1] - length[a.first - 1];
+
+                    // The short branches ordered by where their spans start, with the furthest end
+                    // of a span below each node of the tree, or 0 for none.
+                    std::vector<std::size_t> order(branches.size());
+                    for (std::size_t k = 0; k < order.size(); ++k) order[k] = k;
+                    std::sort(order.begin(), order.end(), [&](std::size_t x, std::size_t y) { return branches[x]._from < branches[y]._from; });
+                    std::size_t leaves = 1;
+                    while (leaves < order.size()) leaves *= 2;
+                    std::vector<std::size_t> reach(2 * leaves, 0);
+                    for (std::size_t k = 0; k < order.size(); ++k) reach[leaves + k] = branches[order[k]]._to;
+                    for (std::size_t k = leaves - 1; k; --k) reach[k] = std::max(reach[2 * k], reach[2 * k + 1]);
+
+                    std::vector<std::size_t> work(order.size()), changed, stack, seen(order.size(), 0);
+                    for (std::size_t k = 0; k < work.size(); ++k) work[k] = k;
+                    _relaxation_rounds = 0;
+                    while (!work.empty())
+                    {
+                        ++_relaxation_rounds;
+                        changed.clear();
+                        // All the branches of a round are checked against the same layout, and
+                        // relaxed together after that.
+                        std::size_t out = 0;
+                        for (auto k : work)
+                        {
+                            auto &b = branches[order[k]];
+                            // from the end of the branch, which is before any padding after it
+                            std::int64_t displacement = addr(b._target) - addr(b._pos) - (std::int64_t)length[b._pos];
+                            if (b._short && (displacement < -128 || displacement > 127)) work[out++] = k;
+                        }
+                        for (std::size_t i = 0; i < out; ++i)
+                        {
+                            std::size_t k = work[i];
+                            auto &b = branches[order[k]];
+                            _code[b._pos]->relax();
+                            std::size_t relaxed = _code[b._pos]->length(model_at(b._pos));
+                            grow(b._pos, relaxed - length[b._pos]);
+                            length[b._pos] = relaxed;
+                            b._short = false;
+                            changed.push_back(b._pos);
+                            for (reach[k += leaves] = 0; k /= 2; ) reach[k] = std::max(reach[2 * k], reach[2 * k + 1]);
+                        }
+                        work.clear();
+                        if (changed.empty()) break;
+
+                        // The padding at the alignments after the first change may change, too.
+                        std::size_t first = *std::min_element(changed.begin(), changed.end());
+                        for (auto a = pad.upper_bound(first); a != pad.end(); ++a)
+                        {
+                            std::size_t p = padding(addr(a->first) - a->second, _alignment[a->first]);
+                            if (p == a->second) continue;
+                            grow(a->first - 1, (std::int64_t)p - (std::int64_t)a->second);
+                            a->second = p;
+                            changed.push_back(a->first);
+                        }
+
+                        // The short branches whose spans contain a change go to the next round.
+                        for (auto c : changed)
+                        {
+                            std::size_t end = std::upper_bound(order.begin(), order.end(), c,
+                                [&](std::size_t x, std::size_t k) { return x < branches[k]._from; }) - order.begin();
+                            stack.assign(1, 1);
+                            while (!stack.empty())
+                            {
+                                std::size_t node = stack.back(), first_leaf = node, width = 1;
+                                stack.pop_back();
+                                while (first_leaf < leaves) first_leaf *= 2, width *= 2;
+                                if (reach[node] < c || first_leaf - leaves >= end) continue;
+                                if (width > 1)
+                                {
+                                    stack.push_back(2 * node);
+                                    stack.push_back(2 * node + 1);
+                                }
+                                else if (seen[node - leaves] != _relaxation_rounds)
+                                {
+                                    seen[node - leaves] = _relaxation_rounds;
+                                    work.push_back(node - leaves);
+                                }
+                            }
+                        }
+                    }
+
+                    layout(length);
+                    _label2addr.clear();
+                    for (auto label : _label2pos) _label2addr[label.first] = _addr[label.second];
                 }
             }
             _text;
@@ -1042,6 +1297,34 @@ namespace codegen
 
             reloc *_reloc = new reloc();
 
+            // The multi-byte NOPs recommended by the Intel and AMD optimization manuals, which decode
+            // faster than a run of one byte NOPs.
+            static void nop_padding(std::vector<byte> &code, std::size_t n)
+            {
+                static const byte nops[9][9] =
+                {
+                    { 0x90 },
+                    { 0x66, 0x90 },
+                    { 0x0f, 0x1f, 0x00 },
+                    { 0x0f, 0x1f, 0x40, 0x00 },
+                    { 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+                    { 0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+                    { 0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00 },
+                    { 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+                    { 0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 }
+                };
+                for (std::size_t k; n; n -= k)
+                {
+                    k = std::min<std::size_t>(n, 9);
+                    code.insert(code.end(), nops[k - 1], nops[k - 1] + k);
+                }
+            }
+
+            static void zero_padding(std::vector<byte> &code, std::size_t n)
+            {
+                code.insert(code.end(), n, 0);
+            }
+
         public:
 
             ~assembler()
@@ -1059,25 +1342,32 @@ namespace codegen
                 sym.mark(*this);
             }
 
+            std::size_t instructions() const
+            {
+                return _text._code.size();
+            }
+
+            // The rounds of branch relaxation the last assembly took
+            std::size_t relaxation_rounds() const
+            {
+                return _text._relaxation_rounds;
+            }
+
             template<class T> function_module<T> assemble_function()
             {
                 _text.compute_label_addresses();
+                _data.layout(_data.lengths());
+                _bss.layout(_bss.lengths());
 
                 _text.compute_global_addresses(_reloc->_text_globals);
                 _data.compute_global_addresses(_reloc->_data_globals);
                 _bss.compute_global_addresses(_reloc->_bss_globals);
 
                 std::vector<byte> text;
-                auto nm = _text._model.begin(), m = nm++;
-                for (std::size_t i = 0; i < _text._code.size(); ++i)
-                {
-                    if (nm != _text._model.end() && nm->first <= i) m = nm++;
-                    _text._code[i]->encode(text, 0,  _reloc, m->second);
-                }
+                _text.encode(text, 0, _reloc, nop_padding);
                 std::vector<byte> data;
-                for (auto i : _data._code) i->encode(data, 1, _reloc, model());
-                std::size_t bss_size = 0;
-                for (auto i : _bss._code) bss_size += i->length(model());
+                _data.encode(data, 1, _reloc, zero_padding);
+                std::size_t bss_size = _bss._addr.back();
 
 #           if 0
                 std::cout << std::endl;
@@ -1110,11 +1400,26 @@ namespace codegen
                 _text.clear();
                 _data.clear();
                 _bss.clear();
+                _section = &_text;
 
                 if (!--_reloc->_refs) delete _reloc;
                 _reloc = new reloc();
             }
 
+            // Aligns the next instruction or data at a multiple of boundary (a power of two) bytes
+            // from the start of the section, unless that takes more than max_skip bytes of padding.
+            // Text is padded with NOPs and data with zeros. Linked text is aligned at 16 bytes.
+            void align(std::size_t boundary, std::size_t max_skip = -1)
+            {
+                _section->_alignment[_section->_code.size()] = alignment { boundary, max_skip };
+            }
+
+            // Aligns the targets of backward branches, i.e. the heads of loops, the same way.
+            void align_loops(std::size_t boundary, std::size_t max_skip = -1)
+            {
+                _text._loop_alignment = alignment { boundary, max_skip };
+            }
+
             std::size_t new_label()
             {
                 return _next_label_index++;
@@ -1156,6 +1461,13 @@ namespace codegen
                 return _a->get_label_addr(_index);
             }
 
+            std::size_t index() const
+            {
+                return _index;
+            }
+
+            // This is the size of a label used as a displacement, which is always 32 bits; branches
+            // choose their own displacement size when the assembler lays out the code.
             byte nbytes() const
             {
                 return 4;
@@ -1211,6 +1523,7 @@ namespace codegen
                 if (!--*_item) delete _item;
                 _item = other._item;
                 ++*_item;
+                return *this;
             }
 
             bool is_known() const
@@ -1248,6 +1561,7 @@ namespace codegen
         template<byte C> class branch_instruction : public instruction
         {
             label _target;
+            bool _near = false;
 
         public:
 
@@ -1255,24 +1569,42 @@ namespace codegen
 
             instruction *clone() const
             {
-                return new branch_instruction(_target);
+                auto b = new branch_instruction(_target);
+                b->_near = _near;
+                return b;
+            }
+
+            std::size_t length(const model &) const
+            {
+                return _near? 6 : 2;
+            }
+
+            bool branch_target(std::size_t &label) const
+            {
+                label = _target.index();
+                return true;
+            }
+
+            void relax()
+            {
+                _near = true;
             }
 
             void encode(std::vector<byte> &code, int section, reloc *rel, const model &m) const
             {
-                auto addr = _target.addr() - code.size() - 2;
-                if (addr > 127 || addr < -128)
+                std::int64_t addr = _target.addr() - code.size() - length(m);
+                if (_near)
                 {
-                    code.push_back(0x70 | C);
-                    code.push_back(addr);
-                }
-                else
-                {
-                    addr -= 4;
                     code.push_back(0xf);
                     code.push_back(0x80 | C);
                     for (int i = 0; i < 4; addr >>= 8, ++i) code.push_back(0xff & addr);
                 }
+                else
+                {
+                    if (addr < -128 || addr > 127) throw branch_out_of_range();
+                    code.push_back(0x70 | C);
+                    code.push_back(addr);
+                }
             }
         };
 
@@ -1364,57 +1696,77 @@ namespace codegen
         using SETG = set_bool_instruction<15>;
         using SETNLE = set_bool_instruction<15>;
 
+        // Jumps and calls to labels start out short, where there is a short form, and are relaxed
+        // like branches. Jumps and calls to other symbols, like globals, are always near, with a
+        // 32 bit displacement filled in when the code is linked.
         template<bool CALL> class jump_instruction : public instruction
         {
-            symbol *_target;
+            label _target;
+            symbol *_symbol = nullptr;
+            bool _near = CALL; // there is no short CALL
 
         public:
 
-            jump_instruction(const symbol &target) : _target(target.clone()) { }
+            jump_instruction(label target) : _target(target) { }
+
+            jump_instruction(const symbol &target) : _symbol(target.clone()), _near(true) { }
 
-            jump_instruction(const jump_instruction &jmp) : _target(jmp._target->clone()) { }
+            jump_instruction(const jump_instruction &jmp) : _target(jmp._target), _symbol(jmp._symbol? jmp._symbol->clone() : nullptr), _near(jmp._near) { }
 
-            jump_instruction(const jump_instruction &&jmp) : _target(jmp._target) { }
+            jump_instruction &operator=(const jump_instruction &) = delete;
 
             ~jump_instruction()
             {
-                if (_target) delete _target;
+                delete _symbol;
             }
 
-            jump_instruction &operator=(const jump_instruction &jmp)
+            instruction *clone() const
             {
-                if (_target) delete _target;
-                _target = jmp._target->clone();
+                return new jump_instruction(*this);
             }
 
-            jump_instruction &&operator=(const jump_instruction &&jmp)
+            std::size_t length(const model &) const
             {
-                if (_target) delete _target;
-                _target = jmp._target;
-                jmp._target = nullptr;
+                return _near? 5 : 2;
             }
 
-            instruction *clone() const
+            bool branch_target(std::size_t &label) const
             {
-                return new jump_instruction(*this);
+                if (_symbol) return false;
+                label = _target.index();
+                return !CALL;
+            }
+
+            void relax()
+            {
+                _near = true;
             }
 
             void encode(std::vector<byte> &code, int section, reloc *rel, const model &m) const
             {
-                if (_target->is_relative())
+                if (_symbol)
                 {
-                    auto addr = _target->addr() - code.size() - 2;
-                    if (!CALL && addr >= -128 && addr <= 127)
+                    code.push_back(CALL? 0xe8 : 0xe9);
+                    std::int64_t addr = _symbol->addr();
+                    if (rel && !_symbol->is_known())
                     {
-                        code.push_back(0xeb);
-                        code.push_back((byte)addr);
-                    }
-                    else
-                    {
-                        addr -= 3;
-                        code.push_back(CALL? 0xe8 : 0xe9);
-                        for (int i = 0; i < 4; addr >>= 8, ++i) code.push_back((byte)addr);
+                        addr -= 4;
+                        rel->add(section, code.size(), _symbol, true, 4);
                     }
+                    for (int i = 0; i < 4; addr >>= 8, ++i) code.push_back((byte)addr);
+                    return;
+                }
+                std::int64_t addr = _target.addr() - code.size() - length(m);
+                if (_near)
+                {
+                    code.push_back(CALL? 0xe8 : 0xe9);
+                    for (int i = 0; i < 4; addr >>= 8, ++i) code.push_back((byte)addr);
+                }
+                else
+                {
+                    if (addr < -128 || addr > 127) throw branch_out_of_range();
+                    code.push_back(0xeb);
+                    code.push_back((byte)addr);
                 }
             }
         };
@@ -1575,7 +1927,8 @@ namespace codegen
         using SHR = barrel_instruction<5>;
         using SAR = barrel_instruction<7>;
 
-        // This is for floating point SSE instructions; integer instructions need a slightly different logic.
+        // This is for SSE instructions with an XMM destination and an XMM or memory source: most of
+        // the floating point ones, and the packed integer arithmetic of SSE2.
         template<byte P, byte C> class typical_sse_instruction : public instruction
         {
             byte _prefix = P; // 0 = none
@@ -1631,6 +1984,276 @@ namespace codegen
         using SQRTPD = typical_sse_instruction<0x66, 0x51>;
         using SQRTSS = typical_sse_instruction<0xf3, 0x51>;
         using SQRTSD = typical_sse_instruction<0xf2, 0x51>;
+        using UCOMISS = typical_sse_instruction<0, 0x2e>;
+        using UCOMISD = typical_sse_instruction<0x66, 0x2e>;
+        using CVTSS2SD = typical_sse_instruction<0xf3, 0x5a>;
+        using CVTSD2SS = typical_sse_instruction<0xf2, 0x5a>;
+        using XORPS = typical_sse_instruction<0, 0x57>;
+        using PADDB = typical_sse_instruction<0x66, 0xfc>;
+        using PADDW = typical_sse_instruction<0x66, 0xfd>;
+        using PADDD = typical_sse_instruction<0x66, 0xfe>;
+        using PADDQ = typical_sse_instruction<0x66, 0xd4>;
+        using PSUBB = typical_sse_instruction<0x66, 0xf8>;
+        using PSUBW = typical_sse_instruction<0x66, 0xf9>;
+        using PSUBD = typical_sse_instruction<0x66, 0xfa>;
+        using PSUBQ = typical_sse_instruction<0x66, 0xfb>;
+        using PAND = typical_sse_instruction<0x66, 0xdb>;
+        using POR = typical_sse_instruction<0x66, 0xeb>;
+        using PXOR = typical_sse_instruction<0x66, 0xef>;
+
+        // Moves between XMM registers and memory. The store form is the opcode after the load form.
+        template<byte P, byte C> class sse_move_instruction : public instruction
+        {
+            sse_reg _reg;
+            reg_mem _mem;
+            bool _store;
+
+            sse_move_instruction(const sse_reg &r, const reg_mem &m, bool store) : _reg(r), _mem(m), _store(store) { }
+
+        public:
+
+            sse_move_instruction(const sse_reg &dst, const reg_mem &src) : sse_move_instruction(dst, src, false) { }
+
+            sse_move_instruction(const sse_reg &dst, const sse_reg &src) : sse_move_instruction(dst, reg_mem(src), false) { }
+
+            sse_move_instruction(const reg_mem &dst, const sse_reg &src) : sse_move_instruction(src, dst, true) { }
+
+            instruction *clone() const
+            {
+                return new sse_move_instruction(_reg, _mem, _store);
+            }
+
+            void encode(std::vector<byte> &code, int section, reloc *rel, const model &m) const
+            {
+                if (P) code.push_back(P);
+                byte rex = (_mem.rex() & 3) | (_reg.index() & 8? 4 : 0);
+                if (rex) code.push_back(0x40 | rex);
+                code.push_back(0xf);
+                code.push_back(C | _store);
+                code.push_back((_reg.index() & 7) << 3 | _mem.modrm());
+                _mem.write_sib_and_displacement(code, section, rel, m);
+            }
+        };
+
+        using MOVSS = sse_move_instruction<0xf3, 0x10>;
+        using MOVSD = sse_move_instruction<0xf2, 0x10>;
+        using MOVUPS = sse_move_instruction<0, 0x10>;
+        using MOVAPS = sse_move_instruction<0, 0x28>;
+
+        // Conversions between integers and floating point numbers, where the integer is the
+        // register or memory operand: to an XMM register with CVTSI2SS and CVTSI2SD, and to an
+        // integer register with CVTTSS2SI and CVTTSD2SI, which truncate like C does. The size of
+        // the integer operand chooses between 32 and 64 bits.
+        template<byte P, byte C> class sse_int_instruction : public instruction
+        {
+            sse_reg _dst;
+            reg_mem _src;
+
+        public:
+
+            sse_int_instruction(const sse_reg &dst, const reg_mem &src) : _dst(dst), _src(src) { }
+
+            sse_int_instruction(const sse_reg &dst, const integer_reg &src) : sse_int_instruction(dst, reg_mem(src)) { }
+
+            instruction *clone() const
+            {
+                return new sse_int_instruction(_dst, _src);
+            }
+
+            void encode(std::vector<byte> &code, int section, reloc *rel, const model &m) const
+            {
+                code.push_back(P);
+                byte rex = _src.rex() | (_dst.index() & 8? 0x44 : 0);
+                if (rex) code.push_back(rex);
+                code.push_back(0xf);
+                code.push_back(C);
+                code.push_back((_dst.index() & 7) << 3 | _src.modrm());
+                _src.write_sib_and_displacement(code, section, rel, m);
+            }
+        };
+
+        template<byte P, byte C> class int_sse_instruction : public instruction
+        {
+            integer_reg _dst;
+            reg_mem _src;
+
+        public:
+
+            int_sse_instruction(const integer_reg &dst, const reg_mem &src) : _dst(dst), _src(src) { }
+
+            int_sse_instruction(const integer_reg &dst, const sse_reg &src) : int_sse_instruction(dst, reg_mem(src)) { }
+
+            instruction *clone() const
+            {
+                return new int_sse_instruction(_dst, _src);
+            }
+
+            void encode(std::vector<byte> &code, int section, reloc *rel, const model &m) const
+            {
+                code.push_back(P);
+                byte rex = (_src.rex() & 3) | (_dst.log2bits() == 6? 8 : 0) | (_dst.index() & 8? 4 : 0);
+                if (rex) code.push_back(0x40 | rex);
+                code.push_back(0xf);
+                code.push_back(C);
+                code.push_back((_dst.index() & 7) << 3 | _src.modrm());
+                _src.write_sib_and_displacement(code, section, rel, m);
+            }
+        };
+
+        using CVTSI2SS = sse_int_instruction<0xf3, 0x2a>;
+        using CVTSI2SD = sse_int_instruction<0xf2, 0x2a>;
+        using CVTTSS2SI = int_sse_instruction<0xf3, 0x2c>;
+        using CVTTSD2SI = int_sse_instruction<0xf2, 0x2c>;
+
+        // Copies the bits between an XMM register and an integer register or memory; with a 32 bit
+        // integer operand, this is MOVD.
+        class MOVQ : public instruction
+        {
+            sse_reg _reg;
+            reg_mem _int;
+            bool _to_int;
+
+            MOVQ(const sse_reg &r, const reg_mem &i, bool to_int) : _reg(r), _int(i), _to_int(to_int) { }
+
+        public:
+
+            MOVQ(const sse_reg &dst, const reg_mem &src) : MOVQ(dst, src, false) { }
+
+            MOVQ(const sse_reg &dst, const integer_reg &src) : MOVQ(dst, reg_mem(src), false) { }
+
+            MOVQ(const reg_mem &dst, const sse_reg &src) : MOVQ(src, dst, true) { }
+
+            MOVQ(const integer_reg &dst, const sse_reg &src) : MOVQ(src, reg_mem(dst), true) { }
+
+            instruction *clone() const
+            {
+                return new MOVQ(_reg, _int, _to_int);
+            }
+
+            void encode(std::vector<byte> &code, int section, reloc *rel, const model &m) const
+            {
+                code.push_back(0x66);
+                byte rex = _int.rex() | (_reg.index() & 8? 0x44 : 0);
+                if (rex) code.push_back(rex);
+                code.push_back(0xf);
+                code.push_back(_to_int? 0x7e : 0x6e);
+                code.push_back((_reg.index() & 7) << 3 | _int.modrm());
+                _int.write_sib_and_displacement(code, section, rel, m);
+            }
+        };
+
+        // AVX instructions have a VEX prefix in place of the legacy prefix, REX, and the opcode
+        // escape bytes. It also encodes the length of the vectors (XMM or YMM) and the first source
+        // operand, which makes the instructions three-operand ones that leave their sources alone.
+        class vex_instruction_base : public instruction
+        {
+        protected:
+
+            // pp of the prefix P, m-mmmm of the opcode map, L, and the registers in ModRM.reg and VEX.vvvv
+            static void encode_vex(std::vector<byte> &code, int section, reloc *rel, const model &m,
+                byte p, byte map, bool l, byte opcode, byte reg, byte vvvv, const reg_mem &rm)
+            {
+                byte pp = p == 0x66? 1 : p == 0xf3? 2 : p == 0xf2? 3 : 0;
+                byte rex = rm.rex();
+                byte r = reg & 8? 0 : 0x80;
+                byte last = (~vvvv & 15) << 3 | (l? 4 : 0) | pp;
+                if (map == 1 && !(rex & 3))
+                {
+                    code.push_back(0xc5);
+                    code.push_back(r | last);
+                }
+                else
+                {
+                    code.push_back(0xc4);
+                    code.push_back(r | (rex & 2? 0 : 0x40) | (rex & 1? 0 : 0x20) | map);
+                    code.push_back(last);
+                }
+                code.push_back(opcode);
+                code.push_back((reg & 7) << 3 | rm.modrm());
+                rm.write_sib_and_displacement(code, section, rel, m);
+            }
+        };
+
+        template<byte P, byte C> class vex_instruction : public vex_instruction_base
+        {
+            reg _dst, _src1;
+            reg_mem _src2;
+
+        public:
+
+            template<byte W> vex_instruction(const simd_reg<W> &dst, const simd_reg<W> &src1, const reg_mem &src2)
+                : _dst(dst), _src1(src1), _src2(src2) { }
+
+            template<byte W> vex_instruction(const simd_reg<W> &dst, const simd_reg<W> &src1, const simd_reg<W> &src2)
+                : vex_instruction(dst, src1, reg_mem(src2)) { }
+
+            instruction *clone() const
+            {
+                return new vex_instruction(*this);
+            }
+
+            void encode(std::vector<byte> &code, int section, reloc *rel, const model &m) const
+            {
+                encode_vex(code, section, rel, m, P, 1, _dst.log2bits() == 8, C, _dst.index(), _src1.index(), _src2);
+            }
+        };
+
+        using VADDPS = vex_instruction<0, 0x58>;
+        using VADDPD = vex_instruction<0x66, 0x58>;
+        using VSUBPS = vex_instruction<0, 0x5c>;
+        using VSUBPD = vex_instruction<0x66, 0x5c>;
+        using VMULPS = vex_instruction<0, 0x59>;
+        using VMULPD = vex_instruction<0x66, 0x59>;
+        using VDIVPS = vex_instruction<0, 0x5e>;
+        using VDIVPD = vex_instruction<0x66, 0x5e>;
+        using VXORPS = vex_instruction<0, 0x57>;
+
+        // With YMM registers, these need AVX2
+        using VPADDB = vex_instruction<0x66, 0xfc>;
+        using VPADDW = vex_instruction<0x66, 0xfd>;
+        using VPADDD = vex_instruction<0x66, 0xfe>;
+        using VPADDQ = vex_instruction<0x66, 0xd4>;
+        using VPSUBB = vex_instruction<0x66, 0xf8>;
+        using VPSUBW = vex_instruction<0x66, 0xf9>;
+        using VPSUBD = vex_instruction<0x66, 0xfa>;
+        using VPSUBQ = vex_instruction<0x66, 0xfb>;
+        using VPAND = vex_instruction<0x66, 0xdb>;
+        using VPOR = vex_instruction<0x66, 0xeb>;
+        using VPXOR = vex_instruction<0x66, 0xef>;
+
+        template<byte P, byte C> class vex_move_instruction : public vex_instruction_base
+        {
+            reg _reg;
+            reg_mem _mem;
+            bool _store;
+
+            vex_move_instruction(const reg &r, const reg_mem &m, bool store) : _reg(r), _mem(m), _store(store) { }
+
+        public:
+
+            template<byte W> vex_move_instruction(const simd_reg<W> &dst, const reg_mem &src) : vex_move_instruction(dst, src, false) { }
+
+            template<byte W> vex_move_instruction(const simd_reg<W> &dst, const simd_reg<W> &src) : vex_move_instruction(dst, reg_mem(src), false) { }
+
+            template<byte W> vex_move_instruction(const reg_mem &dst, const simd_reg<W> &src) : vex_move_instruction(src, dst, true) { }
+
+            instruction *clone() const
+            {
+                return new vex_move_instruction(_reg, _mem, _store);
+            }
+
+            void encode(std::vector<byte> &code, int section, reloc *rel, const model &m) const
+            {
+                encode_vex(code, section, rel, m, P, 1, _reg.log2bits() == 8, C | _store, _reg.index(), 0, _mem);
+            }
+        };
+
+        using VMOVUPS = vex_move_instruction<0, 0x10>;
+        using VMOVAPS = vex_move_instruction<0, 0x28>;
+
+        // Clears the upper halves of the YMM registers, so that SSE code that follows, such as the
+        // caller of a function that used them, does not pay for keeping them
+        using VZEROUPPER = basic_instruction<3, 0xc5, 0xf8, 0x77>;
     }
 }
 
@@ -32,6 +32,8 @@ namespace codegen
         {
             struct conv_gen
             {
+                virtual ~conv_gen() { }
+
                 virtual void arg(unsigned k, const semantics &ty) = 0;
                 virtual void rval(const semantics &type) = 0;
 
@@ -69,6 +71,7 @@ namespace codegen
                     ir::word _fun;
                     remapper<OUT> &_out;
                     unsigned _nintargs = 0;
+                    unsigned _nsseargs = 0;
 
                     pre_ra_gen(remapper<OUT> &out, ir::word fun) : _out(out), _fun(fun) { }
 
@@ -76,7 +79,7 @@ namespace codegen
                     {
                         // rdi, rsi, rdx, rcx, r8, r9
                         // = 7, 6, 2, 1, 8, 9
-                        return k < 2? 7 - k : k < 4? 4 - (k & 1) : k + 4;
+                        return k < 2? 7 - k : k < 4? 4 - k : k + 4;
                     }
 
                     void arg(unsigned k, const semantics &ty)
@@ -90,7 +93,12 @@ namespace codegen
                             _out(ir::Move(_out.add(ir::Reg(temp, ir::x86::id(integer_reg(log2bits, arg_reg(_nintargs - 1))))), _out.add(ir::Arg(_fun, k))));
                             return;
                         }
-                        // TODO: floats, vectors, small structs
+                        if (ty.is<ir::Float>() && (_nsseargs++ < 8))
+                        {
+                            _out(ir::Move(_out.add(ir::Reg(temp, ir::x86::id(sse_reg(_nsseargs - 1)))), _out.add(ir::Arg(_fun, k))));
+                            return;
+                        }
+                        // TODO: vectors, small structs
 
                         // If it's not in a register, it's just a temporary pre-ra:
                         _out(ir::Move(_out.add(ir::Temp(ty.pos())), _out.add(ir::Arg(_fun, k))));
@@ -112,6 +120,8 @@ namespace codegen
                             byte log2bits = ty.is<ir::Ptr>()? 6 : b > 32? 6 : b > 16? 5 : b > 8? 4 : 3;
                             _out(ir::Move(_out.add(ir::RVal(node[0])), _out.add(ir::Reg(rval, ir::x86::id(integer_reg(log2bits, 0))))));
                         }
+                        else if (ty.is<ir::Float>())
+                            _out(ir::Move(_out.add(ir::RVal(node[0])), _out.add(ir::Reg(rval, ir::x86::id(XMM0)))));
                         _out(node);
                     }
 
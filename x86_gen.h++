@@ -19,6 +19,8 @@
 #ifndef CODEGEN_X86_GEN_H
 #define CODEGEN_X86_GEN_H
 
+#include <cstring>
+
 #include "x86_ir.h++"
 #include "semantics.h++"
 
@@ -57,6 +59,7 @@ namespace codegen
 
                 reg_mem operator()(const ir::code &code, ir::word pos, const ir::Reg &node) const
                 {
+                    if (ir::x86::is_simd_reg(node[1])) return reg(ir::x86::log2bits(node[1]), node[1] & 0x1f);
                     return ir::x86::integer_reg(node[1]);
                 }
             };
@@ -131,13 +134,17 @@ namespace codegen
                 }
             };
 
+            // Floating point compares set the flags like unsigned integer ones, with both operands
+            // swapped for Lt and Lte (see gen_compare), and with the parity flag set if either of
+            // them is NaN. Every compare with a NaN is false, apart from Neq.
             struct gen_setcc
             {
                 ir::word _dst;
                 assembler &_a;
                 bool _sgnd;
+                bool _float;
 
-                gen_setcc(assembler &a, ir::word dst, bool sgnd) : _a(a), _dst(dst), _sgnd(sgnd) { }
+                gen_setcc(assembler &a, ir::word dst, bool sgnd, bool flt = false) : _dst(dst), _a(a), _sgnd(sgnd), _float(flt) { }
 
                 void operator()(const ir::code &code, ir::word pos, const ir::node &)
                 {
@@ -147,34 +154,50 @@ namespace codegen
                 void operator()(const ir::code &code, ir::word pos, const ir::Eq &node)
                 {
                     _a(SETE(code.query_at(query_reg_mem(), _dst)));
+                    if (_float)
+                    {
+                        label ordered(_a);
+                        _a(JNP(ordered));
+                        _a(MOV(code.query_at(query_reg_mem(), _dst), 0));
+                        _a(ordered);
+                    }
                 }
 
                 void operator()(const ir::code &code, ir::word pos, const ir::Neq &node)
                 {
                     _a(SETNE(code.query_at(query_reg_mem(), _dst)));
+                    if (_float)
+                    {
+                        label ordered(_a);
+                        _a(JNP(ordered));
+                        _a(MOV(code.query_at(query_reg_mem(), _dst), 1));
+                        _a(ordered);
+                    }
                 }
 
                 void operator()(const ir::code &code, ir::word pos, const ir::Lt &node)
                 {
-                    if (_sgnd) _a(SETL(code.query_at(query_reg_mem(), _dst)));
+                    if (_float) _a(SETA(code.query_at(query_reg_mem(), _dst)));
+                    else if (_sgnd) _a(SETL(code.query_at(query_reg_mem(), _dst)));
                     else _a(SETB(code.query_at(query_reg_mem(), _dst)));
                 }
 
                 void operator()(const ir::code &code, ir::word pos, const ir::Lte &node)
                 {
-                    if (_sgnd) _a(SETLE(code.query_at(query_reg_mem(), _dst)));
+                    if (_float) _a(SETAE(code.query_at(query_reg_mem(), _dst)));
+                    else if (_sgnd) _a(SETLE(code.query_at(query_reg_mem(), _dst)));
                     else _a(SETBE(code.query_at(query_reg_mem(), _dst)));
                 }
 
                 void operator()(const ir::code &code, ir::word pos, const ir::Gt &node)
                 {
-                    if (_sgnd) _a(SETG(code.query_at(query_reg_mem(), _dst)));
+                    if (_sgnd && !_float) _a(SETG(code.query_at(query_reg_mem(), _dst)));
                     else _a(SETA(code.query_at(query_reg_mem(), _dst)));
                 }
 
                 void operator()(const ir::code &code, ir::word pos, const ir::Gte &node)
                 {
-                    if (_sgnd) _a(SETGE(code.query_at(query_reg_mem(), _dst)));
+                    if (_sgnd && !_float) _a(SETGE(code.query_at(query_reg_mem(), _dst)));
                     else _a(SETAE(code.query_at(query_reg_mem(), _dst)));
                 }
             };
@@ -184,8 +207,9 @@ namespace codegen
                 label _l;
                 assembler &_a;
                 bool _sgnd;
+                bool _float;
 
-                gen_jcc(assembler &a, label &l, bool sgnd) : _a(a), _l(l), _sgnd(sgnd) { }
+                gen_jcc(assembler &a, label &l, bool sgnd, bool flt = false) : _l(l), _a(a), _sgnd(sgnd), _float(flt) { }
 
                 void operator()(const ir::code &code, ir::word pos, const ir::node &)
                 {
@@ -194,35 +218,45 @@ namespace codegen
 
                 void operator()(const ir::code &code, ir::word pos, const ir::Eq &node)
                 {
-                    _a(JE(_l));
+                    if (_float)
+                    {
+                        label unordered(_a);
+                        _a(JP(unordered));
+                        _a(JE(_l));
+                        _a(unordered);
+                    }
+                    else _a(JE(_l));
                 }
 
                 void operator()(const ir::code &code, ir::word pos, const ir::Neq &node)
                 {
+                    if (_float) _a(JP(_l));
                     _a(JNE(_l));
                 }
 
                 void operator()(const ir::code &code, ir::word pos, const ir::Lt &node)
                 {
-                    if (_sgnd) _a(JL(_l));
+                    if (_float) _a(JA(_l));
+                    else if (_sgnd) _a(JL(_l));
                     else _a(JB(_l));
                 }
 
                 void operator()(const ir::code &code, ir::word pos, const ir::Lte &node)
                 {
-                    if (_sgnd) _a(JLE(_l));
+                    if (_float) _a(JAE(_l));
+                    else if (_sgnd) _a(JLE(_l));
                     else _a(JBE(_l));
                 }
 
                 void operator()(const ir::code &code, ir::word pos, const ir::Gt &node)
                 {
-                    if (_sgnd) _a(JG(_l));
+                    if (_sgnd && !_float) _a(JG(_l));
                     else _a(JA(_l));
                 }
 
                 void operator()(const ir::code &code, ir::word pos, const ir::Gte &node)
                 {
-                    if (_sgnd) _a(JGE(_l));
+                    if (_sgnd && !_float) _a(JGE(_l));
                     else _a(JAE(_l));
                 }
             };
@@ -249,6 +283,19 @@ namespace codegen
                     auto dst = semantics(code, d);
                     auto src = semantics(code, s);
 
+                    // UCOMISS and UCOMISD only set the flags that unsigned compares look at, so
+                    // Lt and Lte are turned into Gt and Gte, which are false when unordered
+                    if (dst.is<ir::Reg>() && ir::x86::is_simd_reg(dst[1]))
+                    {
+                        auto ty = dst.type();
+                        if (semantics(code, pos).is<ir::Lt>() || semantics(code, pos).is<ir::Lte>()) std::swap(d, s);
+                        semantics x(code, d);
+                        if (!x.is<ir::Reg>()) throw unsupported_ir();
+                        if (ir::x86::bits<64>(ty) == 32) _a(UCOMISS(ir::x86::sse_reg(x[1]), code.query_at(query_reg_mem(), s)));
+                        else _a(UCOMISD(ir::x86::sse_reg(x[1]), code.query_at(query_reg_mem(), s)));
+                        return;
+                    }
+
                     if (src.is<ir::Imm>())
                         _a(CMP(code.query_at(query_reg_mem(), d), src[0]));
                     else if (src.is<ir::Reg>())
@@ -260,11 +307,303 @@ namespace codegen
                 }
             };
 
+            // Floats and vectors, which are in XMM/YMM registers
+            struct simd_type
+            {
+                unsigned _bits; // of the whole value
+                unsigned _elem; // of an element of a vector, or of the whole scalar
+                bool _float;
+            };
+
+            static bool is_simd_reg(const ir::code &code, ir::word pos)
+            {
+                semantics x(code, pos);
+                return x.is<ir::Reg>() && ir::x86::is_simd_reg(x[1]);
+            }
+
+            static simd_type simd(const semantics &ty)
+            {
+                unsigned bits = ir::x86::bits<64>(ty);
+                if (!ty.is<ir::Array>()) return { bits, bits, true };
+                semantics elem(ty.code(), ty[0]);
+                return { bits, ir::x86::bits<64>(elem), elem.is<ir::Float>() };
+            }
+
             assembler _a;
             std::map<ir::word, label> _labels;
 
+            // Stack slots of the spilled temporaries of the current function, which has _frame bytes
+            // of them, one for each stack variable type given to Enter
+            std::map<ir::word, std::int32_t> _slots;
+            std::int32_t _frame = 0, _next_slot = 0;
+
+            features _features = features::host();
+            bool _ymm = false; // whether the current function has touched the upper halves of the YMM registers
+
+            static std::int32_t slot_size(const semantics &type)
+            {
+                return 8 * std::max(1u, ir::x86::bits<64>(type) / 64);
+            }
+
+            reg_mem slot(const ir::code &code, ir::word temp, byte width = 6)
+            {
+                auto s = _slots.find(temp);
+                if (s == _slots.end())
+                {
+                    s = _slots.emplace(temp, _next_slot).first;
+                    _next_slot += slot_size(semantics(code, temp).type());
+                }
+                std::int32_t offset = s->second;
+                if (offset < 0x80)
+                {
+                    immediate<std::int8_t> disp(offset);
+                    return reg_mem(3, width, RSP, &disp);
+                }
+                immediate<std::int32_t> disp(offset);
+                return reg_mem(3, width, RSP, &disp);
+            }
+
+            void need_avx(const simd_type &t)
+            {
+                if (t._bits <= 128) return;
+                if (!_features._avx || (!t._float && !_features._avx2)) throw unsupported_ir();
+                _ymm = true;
+            }
+
+            // Whole registers are copied with VEX encoded moves when there is AVX, as they are
+            // often next to VEX encoded arithmetic
+            void simd_copy(byte dst, byte src, bool ymm)
+            {
+                if (dst == src) return;
+                if (ymm) _a(VMOVAPS(avx_reg(dst), avx_reg(src)));
+                else if (_features._avx) _a(VMOVAPS(sse_reg(dst), sse_reg(src)));
+                else _a(MOVAPS(sse_reg(dst), sse_reg(src)));
+            }
+
+            void simd_load(const simd_type &t, byte dst, const reg_mem &src)
+            {
+                need_avx(t);
+                if (t._bits == 32) _a(MOVSS(sse_reg(dst), src));
+                else if (t._bits == 64) _a(MOVSD(sse_reg(dst), src));
+                else if (t._bits == 256) _a(VMOVUPS(avx_reg(dst), src));
+                else if (_features._avx) _a(VMOVUPS(sse_reg(dst), src));
+                else _a(MOVUPS(sse_reg(dst), src));
+            }
+
+            void simd_store(const simd_type &t, const reg_mem &dst, byte src)
+            {
+                need_avx(t);
+                if (t._bits == 32) _a(MOVSS(dst, sse_reg(src)));
+                else if (t._bits == 64) _a(MOVSD(dst, sse_reg(src)));
+                else if (t._bits == 256) _a(VMOVUPS(dst, avx_reg(src)));
+                else if (_features._avx) _a(VMOVUPS(dst, sse_reg(src)));
+                else _a(MOVUPS(dst, sse_reg(src)));
+            }
+
+            // A float constant goes to the data of the function
+            void simd_constant(const simd_type &t, byte dst, std::uint64_t bits)
+            {
+                global c;
+                simd_load(t, dst, DS[c]);
+                _a.data();
+                _a.align(t._bits / 8);
+                _a(c);
+                if (t._bits == 32) _a(DD(bits));
+                else _a(DQ(bits));
+                _a.text();
+            }
+
+            // The two-address form, like with the integer instructions: the first operand is
+            // copied to the destination, unless it already is there
+            template<class SSE> void sse_binary(byte dst, byte x, const reg_mem &y)
+            {
+                simd_copy(dst, x, false);
+                _a(SSE(sse_reg(dst), y));
+            }
+
+            // Vectors use the three-operand VEX form if there is AVX, and vectors of 256 bits need it
+            template<class SSE, class VEX> void simd_binary(const simd_type &t, byte dst, byte x, const reg_mem &y)
+            {
+                need_avx(t);
+                if (t._bits == 256) _a(VEX(avx_reg(dst), avx_reg(x), y));
+                else if (_features._avx) _a(VEX(sse_reg(dst), sse_reg(x), y));
+                else sse_binary<SSE>(dst, x, y);
+            }
+
+            template<class B, class W, class D, class Q, class VB, class VW, class VD, class VQ>
+                void simd_integer_binary(const simd_type &t, byte dst, byte x, const reg_mem &y)
+            {
+                switch (t._elem)
+                {
+                    case 8: simd_binary<B, VB>(t, dst, x, y); break;
+                    case 16: simd_binary<W, VW>(t, dst, x, y); break;
+                    case 32: simd_binary<D, VD>(t, dst, x, y); break;
+                    default: simd_binary<Q, VQ>(t, dst, x, y); break;
+                }
+            }
+
+            void simd_arithmetic(const ir::code &code, const ir::Move &node, const semantics &src, const simd_type &t)
+            {
+                semantics dst(code, node[0]), x(code, src[0]);
+                if (!dst.is<ir::Reg>() || !x.is<ir::Reg>()) throw unsupported_ir();
+                byte d = dst[1] & 0x1f, a = x[1] & 0x1f;
+                reg_mem b = code.query_at(query_reg_mem(), src[1]);
+
+                if (t._bits <= 64)
+                {
+                    bool s = t._bits == 32;
+                    if (src.is<ir::Add>()) s? sse_binary<ADDSS>(d, a, b) : sse_binary<ADDSD>(d, a, b);
+                    else if (src.is<ir::Sub>()) s? sse_binary<SUBSS>(d, a, b) : sse_binary<SUBSD>(d, a, b);
+                    else if (src.is<ir::Mul>()) s? sse_binary<MULSS>(d, a, b) : sse_binary<MULSD>(d, a, b);
+                    else if (src.is<ir::Div>()) s? sse_binary<DIVSS>(d, a, b) : sse_binary<DIVSD>(d, a, b);
+                    else throw unsupported_node(code, node[1]);
+                }
+                else if (t._float)
+                {
+                    bool s = t._elem == 32;
+                    if (src.is<ir::Add>()) s? simd_binary<ADDPS, VADDPS>(t, d, a, b) : simd_binary<ADDPD, VADDPD>(t, d, a, b);
+                    else if (src.is<ir::Sub>()) s? simd_binary<SUBPS, VSUBPS>(t, d, a, b) : simd_binary<SUBPD, VSUBPD>(t, d, a, b);
+                    else if (src.is<ir::Mul>()) s? simd_binary<MULPS, VMULPS>(t, d, a, b) : simd_binary<MULPD, VMULPD>(t, d, a, b);
+                    else if (src.is<ir::Div>()) s? simd_binary<DIVPS, VDIVPS>(t, d, a, b) : simd_binary<DIVPD, VDIVPD>(t, d, a, b);
+                    else throw unsupported_node(code, node[1]);
+                }
+                // There is no packed integer multiplication or division for all element sizes
+                else if (src.is<ir::Add>()) simd_integer_binary<PADDB, PADDW, PADDD, PADDQ, VPADDB, VPADDW, VPADDD, VPADDQ>(t, d, a, b);
+                else if (src.is<ir::Sub>()) simd_integer_binary<PSUBB, PSUBW, PSUBD, PSUBQ, VPSUBB, VPSUBW, VPSUBD, VPSUBQ>(t, d, a, b);
+                else if (src.is<ir::And>()) simd_binary<PAND, VPAND>(t, d, a, b);
+                else if (src.is<ir::Or>()) simd_binary<POR, VPOR>(t, d, a, b);
+                else if (src.is<ir::Xor>()) simd_binary<PXOR, VPXOR>(t, d, a, b);
+                else throw unsupported_node(code, node[1]);
+            }
+
+            // Conversions to floats from integers, constants, and other floats. Integers of less
+            // than 32 bits and unsigned ones of 64 bits are not supported, as CVTSI2SS and CVTSI2SD
+            // only convert signed integers of 32 or 64 bits.
+            void simd_conv(const ir::code &code, const ir::Move &node, const semantics &src, const simd_type &t)
+            {
+                byte d = semantics(code, node[0])[1] & 0x1f;
+                semantics x(code, src[1]);
+                if (x.is<ir::Imm>())
+                {
+                    std::uint64_t bits;
+                    if (t._bits == 32)
+                    {
+                        float f = x[0];
+                        std::uint32_t b;
+                        std::memcpy(&b, &f, 4);
+                        bits = b;
+                    }
+                    else
+                    {
+                        double f = x[0];
+                        std::memcpy(&bits, &f, 8);
+                    }
+                    simd_constant(t, d, bits);
+                    return;
+                }
+                if (!x.is<ir::Reg>()) throw unsupported_ir();
+                auto ty = x.type();
+                if (ty.is<ir::Int>())
+                {
+                    unsigned b = ir::x86::bits<64>(ty);
+                    if (b < 32 || (b == 64 && !ty.is_signed())) throw unsupported_ir();
+                    auto r = integer_reg(ty.is_signed()? ir::x86::log2bits(x[1]) : 6, x[1] & 0x1f);
+                    if (t._bits == 32) _a(CVTSI2SS(sse_reg(d), r));
+                    else _a(CVTSI2SD(sse_reg(d), r));
+                }
+                else if (!ty.is<ir::Float>()) throw unsupported_ir();
+                else if (ir::x86::bits<64>(ty) == t._bits) simd_copy(d, x[1] & 0x1f, false);
+                else if (t._bits == 32) _a(CVTSD2SS(sse_reg(d), sse_reg(x[1] & 0x1f)));
+                else _a(CVTSS2SD(sse_reg(d), sse_reg(x[1] & 0x1f)));
+            }
+
+            void simd_move(const ir::code &code, ir::word, const ir::Move &node, const semantics &dst, const semantics &src, const simd_type &t)
+            {
+                if (src.is<ir::arithmetic>()) simd_arithmetic(code, node, src, t);
+                else if (dst.is<ir::Reg>())
+                {
+                    if (src.is<ir::Arg>()) return;
+                    byte d = dst[1] & 0x1f;
+                    if (src.is<ir::Reg>()) simd_copy(d, src[1] & 0x1f, t._bits == 256);
+                    else if (src.is<ir::Temp>()) simd_load(t, d, slot(code, node[1], 7));
+                    else if (src.is<ir::Conv>() && t._bits <= 64) simd_conv(code, node, src, t);
+                    else if (src.is<ir::Cast>() && t._bits <= 64)
+                    {
+                        // Floats reinterpret the bits of an integer constant or register
+                        semantics x(code, src[1]);
+                        if (x.is<ir::Imm>()) simd_constant(t, d, x[0]);
+                        else if (x.is<ir::Reg>() && ir::x86::is_integer_reg(x[1]))
+                            _a(MOVQ(sse_reg(d), integer_reg(t._bits == 64? 6 : 5, x[1] & 0x1f)));
+                        else throw unsupported_ir();
+                    }
+                    else throw unsupported_node(code, node[1]);
+                }
+                else if (dst.is<ir::Temp>() && src.is<ir::Reg>()) simd_store(t, slot(code, node[0], 7), src[1] & 0x1f);
+            }
+
+            // Conversions and casts of floats to integers
+            void float_to_int(const ir::code &code, const ir::Move &, const semantics &dst, const semantics &src)
+            {
+                semantics x(code, src[1]);
+                if (!dst.is<ir::Reg>() || !x.is<ir::Reg>()) throw unsupported_ir();
+                auto ty = dst.type();
+                unsigned b = ir::x86::bits<64>(ty), fb = ir::x86::bits<64>(x.type());
+                auto s = sse_reg(x[1] & 0x1f);
+                if (src.is<ir::Cast>()) _a(MOVQ(integer_reg(fb == 64? 6 : 5, dst[1] & 0x1f), s));
+                else
+                {
+                    auto r = integer_reg(b == 64 || (b == 32 && !ty.is_signed())? 6 : 5, dst[1] & 0x1f);
+                    if (fb == 32) _a(CVTTSS2SI(r, s));
+                    else _a(CVTTSD2SI(r, s));
+                }
+            }
+
         public:
 
+            gen()
+            {
+                _a.align_loops(16, 10);
+            }
+
+            // The instruction set extensions to generate code for. They are the ones of the host by
+            // default, and the code should not be run on a processor without them.
+            void target(const features &f)
+            {
+                _features = f;
+            }
+
+            const features &target() const
+            {
+                return _features;
+            }
+
+            // The assembled code so far, without linking it anywhere
+            template<class T> function_module<T> module()
+            {
+                return _a.assemble_function<T>();
+            }
+
+            const assembler &assembly() const
+            {
+                return _a;
+            }
+
+            // for adding instructions of one's own between those generated for the nodes
+            assembler &assembly()
+            {
+                return _a;
+            }
+
+            // Starts over for another function, keeping the settings of the assembler
+            void clear()
+            {
+                _a.clear();
+                _labels.clear();
+                _slots.clear();
+                _frame = _next_slot = 0;
+                _ymm = false;
+            }
+
             template<class NODE> void operator()(const ir::code &code, ir::word pos, const NODE &node) { }
 
             void operator()(const ir::code &code, ir::word pos, const ir::Move &node)
@@ -272,7 +611,7 @@ namespace codegen
                 auto dst = semantics(code, node[0]);
                 auto src = semantics(code, node[1]);
                 auto dst_type = dst.type();
-                if (dst_type.is<ir::Int>())
+                if (dst_type.is<ir::Int>() || dst_type.is<ir::Ptr>())
                 {
                     if (src.is<ir::arithmetic>())
                     {
@@ -282,8 +621,10 @@ namespace codegen
                     else if (src.is<ir::compare>())
                     {
                         code.pass_temp(gen_compare(_a), node[1]);
-                        code.pass_temp(gen_setcc(_a, node[0], semantics(code, src[0]).is_signed()), node[1]);
+                        code.pass_temp(gen_setcc(_a, node[0], semantics(code, src[0]).is_signed(), is_simd_reg(code, src[0])), node[1]);
                     }
+                    else if ((src.is<ir::Conv>() || src.is<ir::Cast>()) && is_simd_reg(code, src[1]))
+                        float_to_int(code, node, dst, src);
                     else if (dst.is<ir::Reg>())
                     {
                         if (src.is<ir::Arg()>()) return; // Arguments are never used directly; the destination temporaries of these Moves are
@@ -295,11 +636,46 @@ namespace codegen
                         }
                         else if (src.is<ir::Imm>())
                             _a(MOV(dreg, src[0]));
+                        else if (src.is<ir::Temp>())
+                            _a(MOV(integer_reg(6, dreg.index()), slot(code, node[1])));
                     }
+                    else if (dst.is<ir::Temp>() && src.is<ir::Reg>())
+                        _a(MOV(slot(code, node[0]), integer_reg(6, ir::x86::integer_reg(src[1]).index())));
                 }
+                else if (dst_type.is<ir::Float>() || dst_type.is<ir::Array>()) simd_move(code, pos, node, dst, src, simd(dst_type));
                 // TODO: more than I'd like to admit
             }
 
+            // Loads and stores through a pointer in a register. The type of the register operand
+            // tells the size.
+            void operator()(const ir::code &code, ir::word, const ir::Ld &node)
+            {
+                auto dst = semantics(code, node[0]), addr = semantics(code, node[1]);
+                if (!dst.is<ir::Reg>() || !addr.is<ir::Reg>()) throw unsupported_ir();
+                auto ty = dst.type();
+                auto a = integer_reg(6, addr[1] & 0x1f);
+                if (ty.is<ir::Int>() || ty.is<ir::Ptr>())
+                {
+                    auto r = ir::x86::integer_reg(dst[1]);
+                    _a(MOV(r, reg_mem(3, r.log2bits(), a)));
+                }
+                else simd_load(simd(ty), dst[1] & 0x1f, reg_mem(3, 7, a));
+            }
+
+            void operator()(const ir::code &code, ir::word, const ir::St &node)
+            {
+                auto addr = semantics(code, node[0]), src = semantics(code, node[1]);
+                if (!addr.is<ir::Reg>() || !src.is<ir::Reg>()) throw unsupported_ir();
+                auto ty = src.type();
+                auto a = integer_reg(6, addr[1] & 0x1f);
+                if (ty.is<ir::Int>() || ty.is<ir::Ptr>())
+                {
+                    auto r = ir::x86::integer_reg(src[1]);
+                    _a(MOV(reg_mem(3, r.log2bits(), a), r));
+                }
+                else simd_store(simd(ty), reg_mem(3, 7, a), src[1] & 0x1f);
+            }
+
             void operator()(const ir::code &code, ir::word pos, const ir::Label &)
             {
                 _labels[pos] = label(_a);
@@ -321,7 +697,7 @@ namespace codegen
                 if (cond.is<ir::compare>())
                 {
                     code.pass_temp(gen_compare(_a), node[1]);
-                    code.pass_temp(gen_jcc(_a, _labels[node[0]], semantics(code, cond[0]).is_signed()), node[1]);
+                    code.pass_temp(gen_jcc(_a, _labels[node[0]], semantics(code, cond[0]).is_signed(), is_simd_reg(code, cond[0])), node[1]);
                 }
                 else
                 {
@@ -330,12 +706,40 @@ namespace codegen
                 }
             }
 
+            void operator()(const ir::code &, ir::word, const ir::RMove &node)
+            {
+                if (ir::x86::is_simd_reg(node[0]))
+                {
+                    bool ymm = ir::x86::log2bits(node[0]) == 8;
+                    _ymm |= ymm;
+                    simd_copy(node[0] & 0x1f, node[1] & 0x1f, ymm);
+                    return;
+                }
+                auto dreg = ir::x86::integer_reg(node[0]), sreg = ir::x86::integer_reg(node[1]);
+                if (dreg.index() != sreg.index()) _a(MOV(integer_reg(6, dreg.index()), integer_reg(6, sreg.index())));
+            }
+
+            void operator()(const ir::code &code, ir::word, const ir::Enter &node)
+            {
+                _slots.clear();
+                _frame = _next_slot = 0;
+                _ymm = false;
+                for (unsigned i = 1; i < node.nargs(); ++i) _frame += slot_size(semantics(code, node[i]));
+                // The return address leaves RSP 8 bytes off 16 byte alignment, and the frame puts it
+                // back, so that calls made by the function find the stack aligned as the ABI promises.
+                if (_frame && _frame % 16 == 0) _frame += 8;
+                if (_frame) _a(SUB(RSP, _frame));
+            }
+
             void operator()(const ir::code &code, ir::word pos, const ir::Exit &node)
             {
+                if (_frame) _a(ADD(RSP, _frame));
+                if (_ymm) _a(VZEROUPPER());
                 _a(RET());
             }
         };
 
+
         template<class T> class function_gen { };
 
         template<class R, class... ARGS> class function_gen<R(ARGS...)> : public gen
@@ -346,6 +750,11 @@ namespace codegen
             {
                 return _a.assemble_function<R(ARGS...)>().link();
             }
+
+            function<R(ARGS...)> fun(arena &a)
+            {
+                return _a.assemble_function<R(ARGS...)>().link(a);
+            }
         };
     }
 }
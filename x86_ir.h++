@@ -35,6 +35,12 @@ namespace codegen
                 return r.index() | (r.log2bits() << 5);
             }
 
+            // XMM registers are 7 << 5 and up, YMM registers 8 << 5 and up
+            template<byte W> static constexpr ir::word id(const x86::simd_reg<W> &r)
+            {
+                return r.index() | (W << 5);
+            }
+
             static constexpr bool is_integer_reg(ir::word id)
             {
                 // TODO: filter out all with bit 4 set apart from 8 bit high half regs
@@ -46,11 +52,21 @@ namespace codegen
                 return id >= 3 && id <= 6;
             }
 
+            static constexpr bool is_simd_reg(ir::word id)
+            {
+                return id >= (7 << 5) && id < (9 << 5) && (id & 0x1f) < 16;
+            }
+
+            static constexpr bool is_simd_reg_group(ir::word id)
+            {
+                return id == 7 || id == 8;
+            }
+
             static constexpr byte log2bits(ir::word id)
             {
                 return
-                    is_integer_reg(id)? id >> 5 :
-                    is_int_reg_group(id)? id & 7 :
+                    is_integer_reg(id) || is_simd_reg(id)? id >> 5 :
+                    is_int_reg_group(id) || is_simd_reg_group(id)? id & 15 :
                     0;
             }
 
@@ -59,15 +75,49 @@ namespace codegen
                 return x86::integer_reg(id >> 5, id & 0x1f);
             }
 
+            static constexpr x86::sse_reg sse_reg(ir::word id)
+            {
+                return x86::sse_reg(id & 0x1f);
+            }
+
+            static constexpr x86::avx_reg avx_reg(ir::word id)
+            {
+                return x86::avx_reg(id & 0x1f);
+            }
+
             static constexpr ir::word int_reg_group(unsigned bits)
             {
                 return bits > 32? 6 : bits > 16? 5 : bits > 8? 4 : 3;
             }
 
+            // The number of bits a value of the type takes in a register, or 0 if it cannot be in
+            // one. Floats are IEEE single or double precision ones, by their significant digits.
+            template<unsigned BITS> static unsigned bits(const semantics &ty)
+            {
+                if (ty.is<Int>())
+                {
+                    auto b = std::abs(ty[0]);
+                    return b > 32? 64 : b > 16? 32 : b > 8? 16 : 8;
+                }
+                else if (ty.is<Ptr>() || ty.is<Fun>()) return BITS;
+                else if (ty.is<Float>()) return ty[3] <= 24? 32 : ty[3] <= 53? 64 : 0;
+                else if (ty.is<Array>()) return bits<BITS>(semantics(ty.code(), ty[0])) * ty[1];
+                return 0;
+            }
+
+            // Floats are in XMM registers, and so are arrays of 128 bits, which are vectors to be
+            // operated on element by element. Arrays of 256 bits are in YMM registers.
             template<unsigned BITS> static ir::word reg_group(const semantics &ty)
             {
                 if (ty.is<Int>()) return int_reg_group(std::abs(ty[0]));
                 else if (ty.is<Ptr>() || ty.is<Fun>()) return BITS == 64? 6 : 5;
+                else if (ty.is<Float>()) return bits<BITS>(ty)? 7 : 0;
+                else if (ty.is<Array>())
+                {
+                    auto b = bits<BITS>(ty);
+                    return b == 128? 7 : b == 256? 8 : 0;
+                }
+                return 0;
             }
         }
     }
@@ -19,6 +19,8 @@
 #ifndef CODEGEN_X86_REGS
 #define CODEGEN_X86_REGS
 
+#include <bitset>
+
 #include "x86_ir.h++"
 
 namespace codegen
@@ -27,7 +29,7 @@ namespace codegen
     {
         class regs64
         {
-            std::bitset<16> _iregs;
+            std::bitset<16> _iregs, _sregs;
 
         public:
 
@@ -61,13 +63,30 @@ namespace codegen
                         return ir::x86::id(integer_reg(ir::x86::log2bits(id), i));
                     }
                 }
-                // TODO: floats and vectors
+                else if (ir::x86::is_simd_reg(id))
+                {
+                    byte index = id & 0x1f;
+                    if (_sregs[index]) return 0;
+                    _sregs.set(index);
+                    return id;
+                }
+                else if (ir::x86::is_simd_reg_group(id))
+                {
+                    if (_sregs.all()) return 0;
+                    for (unsigned i = 0; ; ++i) if (!_sregs[i])
+                    {
+                        _sregs.set(i);
+                        return (id << 5) | i;
+                    }
+                }
+                return 0;
             }
 
             ir::word get_compatible(ir::word id)
             {
                 if (ir::word reg = get_free(id)) return reg;
                 if (ir::x86::is_integer_reg(id)) return get_free(ir::x86::int_reg_group(id));
+                if (ir::x86::is_simd_reg(id)) return get_free(id >> 5);
                 return 0;
             }
 
@@ -80,6 +99,7 @@ namespace codegen
                 if (group == reg) return true;
                 if (ir::x86::is_integer_reg(reg))
                     return ir::x86::is_int_reg_group(group) && ir::x86::log2bits(reg) == ir::x86::log2bits(group);
+                if (ir::x86::is_simd_reg(reg)) return ir::x86::log2bits(reg) == ir::x86::log2bits(group);
                 return false;
             }
 
@@ -87,18 +107,80 @@ namespace codegen
             {
                 if (group == reg) return true;
                 if (ir::x86::is_integer_reg(reg)) return ir::x86::is_int_reg_group(group);
+                if (ir::x86::is_simd_reg(reg)) return ir::x86::is_simd_reg_group(group) || ir::x86::is_simd_reg(group);
                 return false;
             }
 
             void forget(ir::word id)
             {
                 if (ir::x86::is_integer_reg(id)) _iregs.reset(ir::x86::integer_reg(id).index());
-                // TODO: floats and vectors
+                else if (ir::x86::is_simd_reg(id)) _sregs.reset(id & 0x1f);
             }
 
             void reset()
             {
                 for (unsigned i = 0; i < 16; ++i) _iregs[i] = i == 4 || i == 5;
+                _sregs.reset();
+            }
+
+            // linear_ra works with register indices, and asks about them here. The integer
+            // registers are 0-15 and the XMM/YMM registers 16-31.
+            constexpr static unsigned count = 32;
+
+            static constexpr bool is_allocatable(unsigned index)
+            {
+                return index != 4 && index != 5;
+            }
+
+            // rbx, rbp and r12-r15 in the System V ABI, which has no callee saved XMM registers
+            static constexpr bool is_callee_saved(unsigned index)
+            {
+                return index == 3 || index == 5 || (index >= 12 && index < 16);
+            }
+
+            // The index of the register the key specifies, or -1 if it is a group
+            static constexpr int index(ir::word key)
+            {
+                return
+                    ir::x86::is_integer_reg(key)? ir::x86::integer_reg(key).index() :
+                    ir::x86::is_simd_reg(key)? 16 + (key & 0x1f) :
+                    -1;
+            }
+
+            static constexpr bool is_simd(ir::word key)
+            {
+                return ir::x86::is_simd_reg(key) || ir::x86::is_simd_reg_group(key);
+            }
+
+            static constexpr bool accepts(ir::word key, unsigned index)
+            {
+                return is_simd(key)? index >= 16 && index < 32 : index < 16;
+            }
+
+            // The key of register index in the group of the key
+            static constexpr ir::word key(ir::word group, unsigned index)
+            {
+                return
+                    index >= 16? (ir::x86::log2bits(group) == 8? 8 << 5 : 7 << 5) | (index - 16) :
+                    ir::x86::id(integer_reg(ir::x86::is_int_reg_group(group)? ir::x86::log2bits(group) : 6, index));
+            }
+
+            // The key of all of register index, as used for saving it. For the XMM/YMM registers,
+            // the type of the variable saved tells how much of the register is used.
+            static constexpr ir::word full_key(unsigned index)
+            {
+                return index >= 16? (7 << 5) | (index - 16) : ir::x86::id(integer_reg(6, index));
+            }
+
+            static ir::word group(const semantics &type)
+            {
+                return ir::x86::reg_group<64>(type);
+            }
+
+            // The size of the stack slot of a spilled variable of the type, in 64 bit words
+            static unsigned slot_words(const semantics &type)
+            {
+                return std::max(1u, ir::x86::bits<64>(type) / 64);
             }
 
             template<class GEN> static void remap(GEN &gen, const std::map<ir::word, ir::word> &regs)
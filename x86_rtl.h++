@@ -42,15 +42,32 @@ namespace codegen
                 void operator()(const ir::code &code, ir::word pos, const ir::Enter &node) { }
                 void operator()(const ir::code &code, ir::word pos, const ir::Exit &node) { }
 
+                // The overload for typecon loses to this one for each of the type constructors, so
+                // they are told apart here, as the type operand of a Conv or Cast is not a source
                 template<class NODE> void operator()(const ir::code &code, ir::word pos, const NODE &node)
                 {
-                    _a._regs.insert(pos);
+                    if (!std::is_base_of<ir::typecon, NODE>::value) _a._regs.insert(pos);
+                }
+            };
+
+            // The operands of a branch condition are computed into registers, like any source
+            struct handle_cond
+            {
+                rtl_analysis &_a;
+
+                template<class NODE> void operator()(const ir::code &code, ir::word pos, const NODE &node)
+                {
+                    if (!semantics(code, pos).is<ir::compare>()) return;
+                    code.pass_temp(handle_src{ _a }, node[0]);
+                    code.pass_temp(handle_src{ _a }, node[1]);
                 }
             };
 
             template<class NODE> void operator()(const ir::code &code, ir::word pos, const NODE &node)
             {
-                if (_regs.count(pos)) for (unsigned i = 0; i < node.nargs(); ++i) code.pass_temp(handle_src{ *this }, node[i]);
+                if (_regs.count(pos))
+                    for (unsigned i = 0; i < node.nargs(); ++i)
+                        if (node.is_id(i)) code.pass_temp(handle_src{ *this }, node[i]);
             }
 
             void operator()(const ir::code &code, ir::word pos, const ir::Reg &node) { }
@@ -66,6 +83,11 @@ namespace codegen
                 code.pass_temp(handle_src{ *this }, node[1]);
             }
 
+            void operator()(const ir::code &code, ir::word, const ir::Branch &node)
+            {
+                code.pass_temp(handle_cond{ *this }, node[1]);
+            }
+
             void operator()(const ir::code &code, ir::word pos, const ir::St &node)
             {
                 code.pass_temp(handle_src{ *this }, node[0]);
@@ -123,28 +145,66 @@ namespace codegen
                 _out(pos, node);
             }
 
+            // An Imm, or an integer constant as simplify leaves them, which becomes one below
+            static bool is_imm(const ir::code &code, ir::word pos)
+            {
+                semantics sem(code, pos);
+                return sem.is<ir::Imm>() || (sem.is<ir::Cast>() && semantics(code, sem[0]).is<ir::Int>() && semantics(code, sem[1]).is<ir::Imm>());
+            }
+
             void operator()(const ir::code &code, ir::word pos, const ir::Mul &node)
             {
-                if (semantics(code, node[0]).is<ir::Imm>()) (*this)(code, pos, ir::Mul(node[1], node[0]));
-                else if (semantics(code, node[1]).is<ir::Imm>())
+                if (is_imm(code, node[0])) (*this)(code, pos, ir::Mul(node[1], node[0]));
+                else if (is_imm(code, node[1]))
                 {
                     auto imm = _out.add(ir::Temp(semantics(code, node[0]).type().pos()));
                     _out(ir::Move(imm, node[1]));
                     _out(pos, ir::Mul(node[0], imm));
                 }
+                else _out(pos, node);
+            }
+
+            // Integer constants, as simplify leaves them, are just immediates here
+            void operator()(const ir::code &code, ir::word pos, const ir::Cast &node)
+            {
+                semantics ty(code, node[0]), src(code, node[1]);
+                if (!ty.is<ir::Int>() || !src.is<ir::Imm>())
+                {
+                    _out(pos, node);
+                    return;
+                }
+                std::int64_t x = src[0];
+                unsigned bits = std::abs(ty[0]);
+                if (bits < 64)
+                {
+                    std::uint64_t mask = (std::uint64_t(1) << bits) - 1;
+                    x &= mask;
+                    if (ty[0] < 0 && x >> (bits - 1) & 1) x |= ~mask;
+                }
+                _out(pos, ir::Imm(x));
             }
         };
 
-        template<class OUT, unsigned BITS> OUT rtl(const ir::code &code)
+        // Writes the code for register allocation to out, and uses rewritten for the code in
+        // between. Both are cleared first, and keep their storage, so a caller compiling one
+        // function after another can pass the same ones each time.
+        template<class OUT, unsigned BITS> void rtl(const ir::code &code, OUT &out, ir::code &rewritten)
         {
-            ir::code rewritten;
+            rewritten.clear();
             rewriter rwr(rewritten);
             code.pass(rwr);
             rtl_analysis a;
             rewritten.rpass(a);
-            OUT out;
+            out.clear();
             rtl_gen<OUT, BITS> gen(out, a);
             rewritten.pass(gen);
+        }
+
+        template<class OUT, unsigned BITS> OUT rtl(const ir::code &code)
+        {
+            ir::code rewritten;
+            OUT out;
+            rtl<OUT, BITS>(code, out, rewritten);
             return out;
         }
     }